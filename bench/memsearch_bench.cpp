@@ -0,0 +1,155 @@
+// Checks every find_pairs implementation this CPU runs against the old
+// scalar memcmp loop, at needle lengths and match positions around the
+// block edges, then times the vectorized find_mem against that loop.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "memsearch.hpp"
+
+
+namespace {
+
+uint8_t const FREQ_HI[] = "\x08\x09\x09\x0a\x0a\x0b\x0c\x0d\x0d\x0e\x0f\x10\x11\x12\x13\x14"
+                          "\x15\x17\x18\x1a\x1b\x1d\x1f\x20\x22\x24\x27\x29\x2b\x2e\x31\x34"
+                          "\x37\x3a\x3e\x41\x45\x49\x4e\x52\x57\x5c\x62\x68\x6e\x75\x7c\x83"
+                          "\x8b\x93\x9c\xa5\xaf\xb9\xc4\xd0\xdd\xea\xf8\xff";
+
+// the search as it was done before
+uint8_t const* find_mem_scalar(uint8_t const* haystack, int haystack_len, uint8_t const* needle, int needle_len) {
+    for (uint8_t const* h = haystack; haystack_len >= needle_len; ++h, --haystack_len) {
+        if (memcmp(h, needle, needle_len) == 0) return h;
+    }
+    return nullptr;
+}
+
+// Player code is mostly opcodes and small operands, so use a skewed byte
+// distribution. The freq table sits after the player, roughly in the first
+// half of the file.
+std::vector<uint8_t> make_image(int size, std::mt19937& rng) {
+    std::vector<uint8_t> buf(size);
+    std::geometric_distribution<int> dist(0.02);
+    for (uint8_t& b : buf) b = dist(rng);
+    int pos = size / 4 + rng() % (size / 4);
+    memcpy(buf.data() + pos, FREQ_HI, sizeof(FREQ_HI) - 1);
+    return buf;
+}
+
+// Places the needle at each position that starts or ends a needle at, or
+// next to, a 16 or 32 byte block edge, in haystacks of a small alphabet
+// with plenty of near misses, and compares with the old loop.
+bool check_find_mem(FindPairsImpl const& impl, std::mt19937& rng) {
+    for (size_t n : { size_t(1), size_t(2), size_t(3), size_t(12), size_t(16), size_t(33), size_t(MAX_NEEDLE) }) {
+        std::vector<uint8_t> needle(n);
+        for (uint8_t& b : needle) b = rng() % 3;
+        for (size_t len : { n, n + 1, n + 31, n + 32, n + 33, n + 200 }) {
+            std::vector<size_t> places = { 0, len - n };
+            for (size_t edge = 16; edge <= len; edge += 16) {
+                for (size_t at : { edge - 1, edge, edge + 1 }) {
+                    places.push_back(at);
+                    if (at >= n - 1) places.push_back(at - (n - 1));
+                }
+            }
+            for (size_t at : places) {
+                if (at > len - n) continue;
+                // the exact size lets sanitizers see reads past the end
+                std::vector<uint8_t> h(len);
+                for (uint8_t& b : h) b = rng() % 4;
+                memcpy(h.data() + at, needle.data(), n);
+                uint8_t const* want = find_mem_scalar(h.data(), len, needle.data(), n);
+                uint8_t const* got  = find_mem(impl.func, h.data(), len, needle.data(), n);
+                if (got != want) {
+                    printf("ERROR: %s: needle of %d bytes at %d of %d found at %d, not %d\n", impl.name, (int) n,
+                           (int) at, (int) len, got ? int(got - h.data()) : -1, int(want - h.data()));
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Several pairs at once, as the signature scanner uses them, from every
+// start position.
+bool check_find_pairs(FindPairsImpl const& impl, std::mt19937& rng) {
+    for (int count : { 1, 2, 5, 32 }) {
+        std::vector<BytePair> pairs(count);
+        for (BytePair& p : pairs) p = { uint8_t(rng() % 16), uint8_t(rng() % 16), uint16_t(rng() % 40) };
+        std::vector<uint8_t> h(100 + rng() % 100);
+        for (uint8_t& b : h) b = rng() % 16;
+        for (size_t pos = 0; pos <= h.size(); ++pos) {
+            size_t want = pos;
+            for (; want < h.size(); ++want) {
+                bool match = false;
+                for (BytePair const& p : pairs) {
+                    match = match || (h[want] == p.first && want + p.distance < h.size() && h[want + p.distance] == p.last);
+                }
+                if (match) break;
+            }
+            size_t got = impl.func(h.data(), h.size(), pos, pairs.data(), count);
+            if (got != want) {
+                printf("ERROR: %s: %d pairs from %d found at %d, not %d\n", impl.name, count, (int) pos, (int) got,
+                       (int) want);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <class F>
+double time_ms(int iterations, F f) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) f();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+} // namespace
+
+
+int main() {
+    std::mt19937 rng(1234);
+    FindPairsImpl impls[4];
+    int           impl_count = find_pairs_impls(impls, 4);
+    for (int i = 0; i < impl_count; ++i) {
+        if (!check_find_mem(impls[i], rng) || !check_find_pairs(impls[i], rng)) return 1;
+    }
+
+    std::vector<std::vector<uint8_t>> images;
+    size_t total = 0;
+    for (int i = 0; i < 64; ++i) {
+        images.push_back(make_image(2048 + rng() % (16 * 1024), rng));
+        total += images.back().size();
+    }
+
+    for (auto const& img : images) {
+        uint8_t const* a = find_mem_scalar(img.data(), img.size(), FREQ_HI, 12);
+        uint8_t const* b = find_mem(img.data(), img.size(), FREQ_HI, 12);
+        if (!a || a != b) {
+            printf("ERROR: mismatch\n");
+            return 1;
+        }
+    }
+
+    int const iter = 500;
+    size_t sink = 0;
+    double scalar_ms = time_ms(iter, [&] {
+        for (auto const& img : images) sink += find_mem_scalar(img.data(), img.size(), FREQ_HI, 12) - img.data();
+    });
+    double simd_ms = time_ms(iter, [&] {
+        for (auto const& img : images) sink += find_mem(img.data(), img.size(), FREQ_HI, 12) - img.data();
+    });
+
+    double mb = total * double(iter) / (1024 * 1024);
+    printf("checked");
+    for (int i = 0; i < impl_count; ++i) printf(" %s", impls[i].name);
+    printf("\n");
+    printf("freq table search, %d images, %d bytes total\n", (int) images.size(), (int) total);
+    printf(" scalar:      %10.1f MB/s\n", mb / (scalar_ms / 1000));
+    printf(" %-11s %10.1f MB/s\n", (std::string(find_pairs_impl()) + ":").c_str(), mb / (simd_ms / 1000));
+    printf(" speedup:     %10.1fx\n", scalar_ms / simd_ms);
+    return sink == 0;
+}
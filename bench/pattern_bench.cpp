@@ -0,0 +1,234 @@
+// Compares the table driven unpack_pattern against the old branchy row loop,
+// on a large set of generated patterns and on all of its truncations.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "packedpattern.hpp"
+
+
+namespace {
+
+struct Reader {
+    uint8_t const* data;
+    int            size;
+    int            pos;
+    bool           truncated;
+
+    uint8_t peek() {
+        if (pos >= size) return truncated = true, 0;
+        return data[pos];
+    }
+    uint8_t read() {
+        if (pos >= size) return truncated = true, 0;
+        return data[pos++];
+    }
+};
+
+// The loop as it was done before. It allowed a 129th row and then wrote
+// the end mark past the pattern; unpack_pattern stops at MAX_PATTROWS.
+gt::UnpackResult unpack_pattern_old(Reader& in, uint8_t* pattern, int& rows, gt::UnpackState& state) {
+    int instr  = 0;
+    int cmd    = 0;
+    int arg    = 0;
+    int row_nr = 0;
+    for (;;) {
+        int prev_instr = instr;
+        if (in.peek() < 0x40) {
+            instr = in.read();
+            state.instr_count = std::max(state.instr_count, instr);
+        }
+        int note;
+        int repeat = 1;
+        int x = in.read();
+        if (in.truncated) return gt::UNPACK_TRUNCATED;
+        if (x > gt::KEYON) {
+            repeat = 256 - x;
+            note = gt::REST;
+            ++state.repeats;
+        }
+        else if (x >= gt::REST) {
+            note = x;
+        }
+        else if (x >= gt::FIRSTNOTE) {
+            note = x;
+        }
+        else {
+            cmd  = x % 16;
+            arg  = cmd ? in.read() : 0;
+            note = x < gt::FXONLY ? in.read() : gt::REST;
+            if (cmd == 0xf && arg >= 2) ++arg;
+            if ((cmd >= 0x1 && cmd <= 0x4) || cmd == 0xe) {
+                state.max_table[gt::STBL] = std::max(state.max_table[gt::STBL], arg);
+            }
+            if (cmd >= 0x8 && cmd <= 0xa) {
+                state.max_table[cmd - 0x8] = std::max(state.max_table[cmd - 0x8], arg);
+            }
+        }
+        while (repeat--) {
+            if (row_nr > gt::MAX_PATTROWS) return gt::UNPACK_TOO_MANY_ROWS;
+            pattern[row_nr * 4 + 0] = note;
+            pattern[row_nr * 4 + 1] = instr != prev_instr ? instr : 0;
+            pattern[row_nr * 4 + 2] = cmd;
+            pattern[row_nr * 4 + 3] = arg;
+            ++row_nr;
+        }
+        if (in.peek() == 0) break;
+    }
+    in.read();
+    pattern[row_nr * 4] = gt::ENDPATT;
+    rows = row_nr;
+    state.truncated = in.truncated;
+    return gt::UNPACK_OK;
+}
+
+// Patterns as the player packs them: mostly notes and rests, with runs of
+// rests, commands and instrument changes mixed in.
+void pack_pattern(std::vector<uint8_t>& out, std::mt19937& rng) {
+    int len = 16 + rng() % (gt::MAX_PATTROWS - 15);
+    for (int r = 0; r < len;) {
+        if (rng() % 8 == 0) out.push_back(1 + rng() % 0x3f);
+        int k = rng() % 10;
+        if (k < 4) {
+            int run = std::min<int>(1 + rng() % 32, len - r);
+            out.push_back(256 - run);
+            r += run;
+            continue;
+        }
+        if (k < 7) {
+            out.push_back(gt::FIRSTNOTE + rng() % (gt::KEYON - gt::FIRSTNOTE + 1));
+        }
+        else {
+            int cmd = rng() % 16;
+            bool fxonly = rng() % 2;
+            out.push_back((fxonly ? gt::FXONLY : gt::FX) + cmd);
+            if (cmd) out.push_back(rng() % 256);
+            if (!fxonly) out.push_back(gt::FIRSTNOTE + rng() % (gt::KEYON - gt::FIRSTNOTE + 1));
+        }
+        ++r;
+    }
+    out.push_back(0);
+}
+
+struct Decoded {
+    std::vector<uint8_t> rows;
+    gt::UnpackState      state;
+    int                  result = gt::UNPACK_OK;
+    int                  pos    = 0;
+};
+
+template <class F>
+Decoded decode_all(uint8_t const* data, int size, F unpack) {
+    Decoded d;
+    // room for the end mark the old loop writes after 129 rows
+    uint8_t pattern[gt::MAX_PATTROWS * 4 + 8];
+    int pos = 0;
+    while (pos < size) {
+        int rows;
+        d.result = unpack(data, size, pos, pattern, rows, d.state);
+        if (d.result != gt::UNPACK_OK) break;
+        d.rows.insert(d.rows.end(), pattern, pattern + rows * 4 + 1);
+    }
+    d.pos = pos;
+    return d;
+}
+
+// rows of all patterns, without keeping them
+template <class F>
+int count_rows(uint8_t const* data, int size, uint8_t* pattern, F unpack) {
+    gt::UnpackState state;
+    int pos   = 0;
+    int total = 0;
+    while (pos < size) {
+        int rows;
+        if (unpack(data, size, pos, pattern, rows, state) != gt::UNPACK_OK) break;
+        total += rows;
+    }
+    return total;
+}
+
+gt::UnpackResult old_adapter(uint8_t const* data, int size, int& pos, uint8_t* pattern, int& rows, gt::UnpackState& state) {
+    Reader in = { data, size, pos, false };
+    gt::UnpackResult res = unpack_pattern_old(in, pattern, rows, state);
+    if (in.truncated) state.truncated = true;
+    pos = in.pos;
+    return res;
+}
+
+bool same(Decoded const& a, Decoded const& b) {
+    return a.rows == b.rows && a.result == b.result && a.pos == b.pos &&
+           a.state.instr_count == b.state.instr_count && a.state.repeats == b.state.repeats &&
+           a.state.truncated == b.state.truncated &&
+           std::equal(a.state.max_table, a.state.max_table + gt::MAX_TABLES, b.state.max_table);
+}
+
+template <class F>
+double time_ms(int iterations, F f) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) f();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+} // namespace
+
+
+int main() {
+    std::mt19937 rng(1234);
+    std::vector<uint8_t> data;
+    int const patterns = 4096;
+    for (int i = 0; i < patterns; ++i) pack_pattern(data, rng);
+
+    Decoded ref = decode_all(data.data(), data.size(), old_adapter);
+    if (!same(ref, decode_all(data.data(), data.size(), gt::unpack_pattern))) {
+        printf("ERROR: mismatch\n");
+        return 1;
+    }
+    // every truncation of the first patterns, and rows past MAX_PATTROWS
+    for (int size = 0; size < 2048; ++size) {
+        if (!same(decode_all(data.data(), size, old_adapter), decode_all(data.data(), size, gt::unpack_pattern))) {
+            printf("ERROR: mismatch at size %d\n", size);
+            return 1;
+        }
+    }
+    std::vector<uint8_t> runs(gt::MAX_PATTROWS / 32 + 2, 256 - 32);
+    runs.push_back(0);
+    if (!same(decode_all(runs.data(), runs.size(), old_adapter), decode_all(runs.data(), runs.size(), gt::unpack_pattern))) {
+        printf("ERROR: mismatch on too many rows\n");
+        return 1;
+    }
+    // the one intended difference: 129 rows are too many
+    std::vector<uint8_t> rows129(gt::MAX_PATTROWS / 32, 256 - 32);
+    rows129.insert(rows129.end(), { gt::FIRSTNOTE, 0 });
+    Decoded old129 = decode_all(rows129.data(), rows129.size(), old_adapter);
+    Decoded new129 = decode_all(rows129.data(), rows129.size(), gt::unpack_pattern);
+    if (old129.result != gt::UNPACK_OK || new129.result != gt::UNPACK_TOO_MANY_ROWS) {
+        printf("ERROR: 129 rows not rejected\n");
+        return 1;
+    }
+
+    int const iter = 50;
+    std::vector<uint8_t> pattern(gt::MAX_PATTROWS * 4 + 4);
+    int    rows = count_rows(data.data(), data.size(), pattern.data(), gt::unpack_pattern);
+    size_t sink = 0;
+    // best of a few rounds, alternating
+    double old_ms = 1e30, new_ms = 1e30;
+    for (int round = 0; round < 5; ++round) {
+        old_ms = std::min(old_ms, time_ms(iter, [&] {
+            sink += count_rows(data.data(), data.size(), pattern.data(), old_adapter);
+        }));
+        new_ms = std::min(new_ms, time_ms(iter, [&] {
+            sink += count_rows(data.data(), data.size(), pattern.data(), gt::unpack_pattern);
+        }));
+    }
+
+    double mb = data.size() * double(iter) / (1024 * 1024);
+    double mrows = rows * double(iter) / 1e6;
+    printf("pattern unpacking, %d patterns, %d bytes, %d rows\n", patterns, (int) data.size(), rows);
+    printf(" branches:    %10.1f MB/s %10.1f Mrows/s\n", mb / (old_ms / 1000), mrows / (old_ms / 1000));
+    printf(" table:       %10.1f MB/s %10.1f Mrows/s\n", mb / (new_ms / 1000), mrows / (new_ms / 1000));
+    printf(" speedup:     %10.1fx\n", old_ms / new_ms);
+    return sink == 0;
+}
@@ -0,0 +1,521 @@
+// Times the conversion stages on a synthetic corpus that is generated on the
+// fly, so no tune files are needed. Then compares whole conversions with a
+// fresh song per file to those through a sid2sng::Converter, which must not
+// allocate once it has seen the corpus. Before timing, it checks that
+// gt::optimize() leaves every converted song playing the same rows, and that
+// a Converter fed the corpus and damaged copies of it in sequence gives the
+// same results as fresh conversions, and that compact songs hold the same
+// song in a fraction of the memory, and that a song pack reads back what was
+// written to it. Saved songs must also load back to the same bytes.
+//   sid2sng_bench [iterations] [-write dir]
+// -write additionally saves the corpus as sid files, e.g. for timing the
+// command line tool.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include "archive.hpp"
+#include "compactsong.hpp"
+#include "sid2song.hpp"
+#include "sidgen.hpp"
+#include "sidindex.hpp"
+#include "songopt.hpp"
+#include "songpack.hpp"
+
+
+// all heap allocations of the process
+static std::atomic<uint64_t> g_allocations(0);
+
+// out of line, or gcc sees malloc paired with delete and warns
+#if defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+NOINLINE void* operator new(size_t size) {
+    ++g_allocations;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+NOINLINE void operator delete(void* p) noexcept {
+    free(p);
+}
+
+NOINLINE void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+
+namespace {
+
+enum {
+    VARIANTS = 8,   // images per flag combination
+};
+
+enum Stage {
+    HEADER,
+    ANCHOR,
+    AUTODETECT,
+    ORDER_LISTS,
+    PATTERNS,
+    INSTRUMENTS,
+    SAVE,
+    STAGE_COUNT,
+};
+
+char const* const STAGE_NAMES[] = {
+    "header load",
+    "anchor search",
+    "autodetect",
+    "order lists",
+    "patterns",
+    "instr/tables",
+    "Song::save",
+};
+
+using Clock = std::chrono::steady_clock;
+
+struct Timer {
+    double           ms[STAGE_COUNT] = {};
+    Clock::time_point t = Clock::now();
+
+    void lap(Stage s) {
+        Clock::time_point now = Clock::now();
+        ms[s] += std::chrono::duration<double, std::milli>(now - t).count();
+        t = now;
+    }
+};
+
+static_assert(uint32_t(GEN_NOPULSE) == sid2sng::NOPULSE && uint32_t(GEN_NOWAVEDELAY) == sid2sng::NOWAVEDELAY,
+              "generator flags differ from sid2sng::Feature");
+
+// the same sequence of calls as Sid2Song::convert, with a lap after each stage
+bool convert(Sid2Song& s, std::vector<uint8_t> const& img, std::vector<uint8_t>& sng, Timer& timer) {
+    ByteSpan data(img.data(), img.size());
+    if (!s.load_sid(data)) return false;
+    timer.lap(HEADER);
+    if (!s.find_freq_table()) return false;
+    timer.lap(ANCHOR);
+    s.autodetect_options();
+    timer.lap(AUTODETECT);
+    if (!s.decode_order_lists()) return false;
+    timer.lap(ORDER_LISTS);
+    if (!s.decode_patterns()) return false;
+    timer.lap(PATTERNS);
+    if (!s.decode_instruments() || !s.decode_tables()) return false;
+    timer.lap(INSTRUMENTS);
+    s.song().save(sng);
+    timer.lap(SAVE);
+    return true;
+}
+
+// One pattern as an order list plays it, with the instrument numbers
+// replaced by the instruments, which the optimizer renumbers.
+struct Play {
+    int                  transpose;
+    std::vector<uint8_t> rows;
+
+    bool operator==(Play const& p) const { return transpose == p.transpose && rows == p.rows; }
+};
+
+// The plays of an order list, and how many come before its restart position.
+void expand(gt::Song const& song, uint8_t const* order, std::vector<Play>& plays, size_t& restart) {
+    plays.clear();
+    restart       = SIZE_MAX;
+    int transpose = -1;
+    int len       = 0;
+    while (len < gt::MAX_SONGLEN && order[len] < gt::LOOPSONG) ++len;
+    for (int i = 0; i < len; ++i) {
+        if (i == order[len + 1]) restart = plays.size();
+        int times = 1;
+        if (order[i] >= gt::TRANSDOWN) {
+            transpose = order[i];
+            continue;
+        }
+        if (order[i] >= gt::REPEAT) {
+            times = order[i] - gt::REPEAT + 1;
+            if (++i == len) break;
+        }
+        Play play = { transpose, {} };
+        uint8_t const* row = song.pattern[order[i]];
+        for (; row[0] != gt::ENDPATT; row += 4) {
+            play.rows.insert(play.rows.end(), { row[0], row[2], row[3] });
+            if (row[1]) {
+                uint8_t const* instr = reinterpret_cast<uint8_t const*>(&song.instr[row[1]]);
+                play.rows.insert(play.rows.end(), instr, instr + sizeof(gt::Instr));
+            }
+        }
+        plays.insert(plays.end(), times, play);
+    }
+}
+
+// Adds work for the optimizer: a copy of every used pattern that the second
+// and later plays of it switch to, and an unused instrument 1.
+void add_redundancy(gt::Song& song) {
+    int patterns = song.highestusedpattern + 1;
+    int copies   = std::min(patterns, gt::MAX_PATT - patterns);
+    for (int p = 0; p < copies; ++p) memcpy(song.pattern[patterns + p], song.pattern[p], sizeof(song.pattern[p]));
+    bool played[gt::MAX_PATT] = {};
+    for (auto& song_orders : song.songorder) {
+        for (uint8_t* order : song_orders) {
+            for (int i = 0; i < gt::MAX_SONGLEN && order[i] < gt::LOOPSONG; ++i) {
+                uint8_t& p = order[i];
+                if (p >= gt::REPEAT) continue;
+                if (played[p] && p < copies) p += patterns;
+                else played[p] = true;
+            }
+        }
+    }
+    if (song.highestusedinstr + 1 < gt::MAX_INSTR) {
+        for (int i = song.highestusedinstr; i > 0; --i) song.instr[i + 1] = song.instr[i];
+        for (int p = 0; p < patterns + copies; ++p) {
+            for (int r = 0; r <= gt::MAX_PATTROWS && song.pattern[p][r * 4] != gt::ENDPATT; ++r) {
+                if (song.pattern[p][r * 4 + 1]) ++song.pattern[p][r * 4 + 1];
+            }
+        }
+    }
+    song.count_pattern_lengths();
+}
+
+// Optimizes a copy of the song and compares what the order lists play.
+bool check_optimize(gt::Song const& song, gt::OptimizeStats& stats) {
+    auto opt = std::make_unique<gt::Song>(song);
+    stats = gt::optimize(*opt);
+    std::vector<Play> before, after;
+    size_t restart_before, restart_after;
+    for (int s = 0; s < gt::MAX_SONGS; ++s) {
+        for (int c = 0; c < song.channels; ++c) {
+            expand(song, song.songorder[s][c], before, restart_before);
+            expand(*opt, opt->songorder[s][c], after, restart_after);
+            if (before != after || restart_before != restart_after) {
+                printf("ERROR: optimized song %d channel %d plays differently\n", s, c);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Converts the images and damaged copies of them in turn through one
+// converter, failures between successes, and compares each result with a
+// fresh conversion. The last copy only lacks the terminator of the last
+// pattern, which must fail without a song.
+bool check_reuse(std::vector<std::vector<uint8_t>> const& images, sid2sng::Options const& options) {
+    sid2sng::Converter   conv(options);
+    std::mt19937         rng(1);
+    std::vector<uint8_t> sid, sng;
+    int                  failed = 0;
+    for (size_t i = 0; i < images.size(); ++i) {
+        for (int m = 0; m < 8; ++m) {
+            sid = images[i];
+            if (m == 7) {
+                sid.pop_back();
+            }
+            else {
+                for (int k = 0; k < m * 2; ++k) sid[rng() % sid.size()] = rng();
+                if (m % 4 == 3) sid.resize(rng() % sid.size());
+            }
+            ByteSpan               span(sid.data(), sid.size());
+            sid2sng::Result const& res   = conv.convert(span);
+            sid2sng::Result        fresh = sid2sng::convert(span, options, sng);
+            ByteSpan               song  = conv.sng();
+            failed += !res.ok();
+            if (res.error != fresh.error || res.features != fresh.features || res.warnings != fresh.warnings ||
+                res.log != fresh.log ||
+                (res.ok() && (song.size() != sng.size() || !std::equal(sng.begin(), sng.end(), song.begin())))) {
+                printf("ERROR: image %d, damaged copy %d converts differently in a reused Converter\n", (int) i, m);
+                return false;
+            }
+            if (m == 7 && res.ok()) {
+                printf("ERROR: image %d converts without its last byte\n", (int) i);
+                return false;
+            }
+            // a failed conversion must not leave a song to write or cache
+            if (!res.ok() && !song.empty()) {
+                printf("ERROR: image %d, damaged copy %d fails but gives a song\n", (int) i, m);
+                return false;
+            }
+        }
+    }
+    if (!failed || failed == int(images.size()) * 8) {
+        printf("ERROR: reuse check needs both failed and clean conversions\n");
+        return false;
+    }
+    return true;
+}
+
+bool same_bytes(ByteSpan a, uint8_t const* b) {
+    return std::equal(a.begin(), a.end(), b);
+}
+
+// Converts every image into a compact song, all kept at once, and compares
+// the image and every section with the full song of the conversion.
+bool check_compact(std::vector<std::vector<uint8_t>> const& images) {
+    sid2sng::Converter           conv{ sid2sng::Options() };
+    std::vector<gt::CompactSong> songs(images.size());
+    std::vector<uint8_t>         sng;
+    auto                         round_trip = std::make_unique<gt::Song>();
+    size_t                       memory     = 0;
+    for (size_t i = 0; i < images.size(); ++i) {
+        ByteSpan         sid(images[i].data(), images[i].size());
+        gt::CompactSong& c = songs[i];
+        conv.convert(sid, c);
+        sid2sng::convert(sid, sid2sng::Options(), sng);
+        gt::Song const& s  = conv.song();
+        bool            ok = c.image().size() == sng.size() && same_bytes(c.image(), sng.data());
+        for (int d = 0; d < c.songs(); ++d) {
+            for (int ch = 0; ch < c.channels(); ++ch) ok = ok && same_bytes(c.order_list(d, ch), s.songorder[d][ch]);
+        }
+        for (int p = 0; p < c.patterns(); ++p) ok = ok && same_bytes(c.pattern(p), s.pattern[p]);
+        for (int n = 1; n <= c.instruments(); ++n) ok = ok && memcmp(&c.instr(n), &s.instr[n], sizeof(gt::Instr)) == 0;
+        for (int t = 0; t < gt::MAX_TABLES; ++t) {
+            ok = ok && same_bytes(c.ltable(t), s.ltable[t]) && same_bytes(c.rtable(t), s.rtable[t]);
+        }
+        std::vector<uint8_t> again;
+        ok = ok && c.to_song(*round_trip);
+        round_trip->save(again);
+        if (!ok || again != sng) {
+            printf("ERROR: image %d: compact song differs\n", (int) i);
+            return false;
+        }
+        memory += c.memory_size();
+    }
+    printf("%d compact songs, %.0f bytes each, a gt::Song takes %d\n", (int) songs.size(),
+           memory / double(songs.size()), (int) sizeof(gt::Song));
+    return true;
+}
+
+// Writes the images to a song pack in reverse path order, some of them
+// failing and some with names that need a GNU long name, then reads it back
+// both as a pack and as a tar file and compares every member and index entry.
+bool check_pack(std::vector<std::vector<uint8_t>> const& images) {
+    struct Written {
+        std::string          path;
+        std::string          sng_name;
+        sid2sng::Result      res;
+        uint64_t             hash;
+        std::vector<uint8_t> sng;
+    };
+    std::string filename = (std::filesystem::temp_directory_path() / "sid2sng_bench_pack.tar").string();
+    sid2sng::Converter   conv{ sid2sng::Options() };
+    std::vector<Written> written(images.size());
+    std::vector<uint8_t> sid;
+    PackWriter           writer;
+    if (!writer.open(filename.c_str())) {
+        printf("ERROR: could not write %s\n", filename.c_str());
+        return false;
+    }
+    for (size_t i = images.size(); i-- > 0;) {
+        Written& w = written[i];
+        char name[16];
+        snprintf(name, sizeof(name), "gen%03d", (int) i);
+        w.path     = (i % 3 ? std::string("pack/") : std::string(120, 'd') + "/") + name + ".sid";
+        w.sng_name = w.path.substr(0, w.path.size() - 4) + ".sng";
+        sid = images[i];
+        if (i % 5 == 0) sid.pop_back();
+        ByteSpan span(sid.data(), sid.size());
+        w.hash = SidIndex::hash(span);
+        w.res  = conv.convert(span);
+        w.sng.assign(conv.sng().begin(), conv.sng().end());
+        writer.add(w.path, w.sng_name, w.hash, w.res, conv.sng());
+    }
+    bool ok = writer.finish();
+
+    SongPack    pack;
+    Archive     tar;
+    std::string error;
+    ok = ok && pack.open(filename.c_str(), &error) && tar.open(filename.c_str(), &error);
+    ok = ok && pack.size() == int(written.size()) && pack.find("pack/missing.sid") < 0;
+    std::vector<Archive::Member> const& members = tar.members();
+    std::vector<uint8_t>                buffer;
+    size_t                              m = 0;
+    for (size_t i = images.size(); ok && i-- > 0;) {
+        Written const& w = written[i];
+        int            n = pack.find(w.path);
+        if (n < 0) {
+            ok = false;
+            break;
+        }
+        SongPack::Entry e = pack.entry(n);
+        ok = e.path == w.path && e.hash == w.hash && e.error == w.res.error && e.warnings == w.res.warnings &&
+             e.features == w.res.features && e.song.size() == w.sng.size() && same_bytes(e.song, w.sng.data());
+        // the members are the songs in the order they were added
+        if (ok && w.res.ok()) {
+            ByteSpan data;
+            ok = m < members.size() && members[m].name == w.sng_name && tar.read(members[m], buffer, data) &&
+                 data.size() == w.sng.size() && same_bytes(data, w.sng.data());
+            ++m;
+        }
+    }
+    ok = ok && m + 1 == members.size() && members[m].name == "sid2sng.index";
+    std::filesystem::remove(filename);
+    if (!ok) {
+        printf("ERROR: song pack reads back differently %s\n", error.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+
+int main(int argc, char** argv) {
+    int         iter     = 200;
+    char const* writedir = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-write") == 0 && i + 1 < argc) writedir = argv[++i];
+        else iter = std::max(1, atoi(argv[i]));
+    }
+
+    std::vector<std::vector<uint8_t>> images;
+    std::vector<uint32_t>             flags;
+    size_t total = 0;
+    for (uint32_t f = 0; f < GEN_FLAG_COMBOS; ++f) {
+        for (uint32_t v = 0; v < VARIANTS; ++v) {
+            images.push_back(generate_sid(f * VARIANTS + v, f));
+            flags.push_back(f);
+            total += images.back().size();
+        }
+    }
+
+    if (writedir) {
+        for (size_t i = 0; i < images.size(); ++i) {
+            std::string name = std::string(writedir) + "/gen" + std::to_string(flags[i]) + "_"
+                             + std::to_string(i % VARIANTS) + ".sid";
+            FILE* file = fopen(name.c_str(), "wb");
+            if (!file || fwrite(images[i].data(), 1, images[i].size(), file) != images[i].size()) {
+                printf("ERROR: could not write %s\n", name.c_str());
+                return 1;
+            }
+            fclose(file);
+        }
+    }
+
+    // the song is too big for the stack
+    auto song = std::make_unique<gt::Song>();
+    auto s    = std::make_unique<Sid2Song>(*song, sid2sng::Options());
+    std::vector<uint8_t> sng;
+
+    // every image has to convert cleanly and with the right options
+    for (size_t i = 0; i < images.size(); ++i) {
+        s->m_log.clear();
+        if (!s->convert(ByteSpan(images[i].data(), images[i].size())) || !s->m_log.buffer().empty()) {
+            printf("ERROR: image %d\n%s", (int) i, s->m_log.buffer().c_str());
+            return 1;
+        }
+        if (s->features() != flags[i]) {
+            printf("ERROR: image %d: detected %02X, expected %02X\n", (int) i, s->features(), flags[i]);
+            return 1;
+        }
+    }
+
+    // a saved song loads back to the same bytes
+    auto loaded = std::make_unique<gt::Song>();
+    std::vector<uint8_t> again;
+    for (size_t i = 0; i < images.size(); ++i) {
+        s->convert(ByteSpan(images[i].data(), images[i].size()));
+        s->song().save(sng);
+        std::string error;
+        bool ok = loaded->load(sng.data(), sng.size(), &error);
+        loaded->save(again);
+        if (!ok || again != sng) {
+            printf("ERROR: image %d: saved song loads differently %s\n", (int) i, error.c_str());
+            return 1;
+        }
+    }
+
+    // optimizing must not change what any of them plays, also with patterns
+    // and instruments to merge and drop
+    gt::OptimizeStats total_stats;
+    for (size_t i = 0; i < images.size(); ++i) {
+        s->convert(ByteSpan(images[i].data(), images[i].size()));
+        auto redundant = std::make_unique<gt::Song>(s->song());
+        add_redundancy(*redundant);
+        gt::OptimizeStats stats;
+        for (gt::Song const* song : { &s->song(), redundant.get() }) {
+            if (!check_optimize(*song, stats)) {
+                printf("ERROR: image %d\n", (int) i);
+                return 1;
+            }
+        }
+        total_stats.merged_patterns     += stats.merged_patterns;
+        total_stats.dropped_instruments += stats.dropped_instruments;
+    }
+    if (!total_stats.merged_patterns || !total_stats.dropped_instruments) {
+        printf("ERROR: optimizer check merged no patterns or dropped no instruments\n");
+        return 1;
+    }
+
+    // reused converters must give the same results as fresh ones
+    sid2sng::Options optimize, search;
+    optimize.optimize = true;
+    search.search     = true;
+    for (sid2sng::Options const& options : { sid2sng::Options(), optimize, search }) {
+        if (!check_reuse(images, options)) return 1;
+    }
+
+    if (!check_compact(images)) return 1;
+    if (!check_pack(images)) return 1;
+
+    Timer timer;
+    for (int n = 0; n < iter; ++n) {
+        for (auto const& img : images) {
+            timer.t = Clock::now();
+            convert(*s, img, sng, timer);
+        }
+    }
+
+    double mb     = total * double(iter) / (1024 * 1024);
+    double files  = images.size() * double(iter);
+    double all_ms = 0;
+    printf("%d synthetic sids, %d bytes total, %d iterations\n", (int) images.size(), (int) total, iter);
+    printf(" %-14s %10s %12s\n", "stage", "MB/s", "us/file");
+    for (int st = 0; st < STAGE_COUNT; ++st) {
+        all_ms += timer.ms[st];
+        printf(" %-14s %10.1f %12.3f\n", STAGE_NAMES[st], mb / (timer.ms[st] / 1000), timer.ms[st] * 1000 / files);
+    }
+    printf(" %-14s %10.1f %12.3f\n", "total", mb / (all_ms / 1000), all_ms * 1000 / files);
+
+    // whole conversions, once with a new song and buffers per file
+    auto time_convert = [&](auto&& convert, uint64_t& allocations) {
+        uint64_t          before = g_allocations;
+        Clock::time_point t      = Clock::now();
+        for (int n = 0; n < iter; ++n) {
+            for (auto const& img : images) convert(ByteSpan(img.data(), img.size()));
+        }
+        allocations = g_allocations - before;
+        return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+    };
+    uint64_t fresh_allocations;
+    double   fresh_ms = time_convert([](ByteSpan sid) {
+        std::vector<uint8_t> sng;
+        sid2sng::convert(sid, sid2sng::Options(), sng);
+    }, fresh_allocations);
+
+    // and once through a converter, after a round to grow its buffers
+    sid2sng::Converter conv{ sid2sng::Options() };
+    for (auto const& img : images) conv.convert(ByteSpan(img.data(), img.size()));
+    uint64_t reused_allocations;
+    double   reused_ms = time_convert([&conv](ByteSpan sid) { conv.convert(sid); }, reused_allocations);
+
+    printf(" %-14s %10s %12s %12s\n", "convert", "MB/s", "us/file", "allocs/file");
+    printf(" %-14s %10.1f %12.3f %12.2f\n", "fresh song", mb / (fresh_ms / 1000), fresh_ms * 1000 / files,
+           fresh_allocations / files);
+    printf(" %-14s %10.1f %12.3f %12.2f\n", "Converter", mb / (reused_ms / 1000), reused_ms * 1000 / files,
+           reused_allocations / files);
+    if (reused_allocations) {
+        printf("ERROR: %llu allocations in repeated conversions\n", (unsigned long long) reused_allocations);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,289 @@
+#include "sidgen.hpp"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+
+namespace {
+
+uint8_t const FREQ_HI[] = "\x08\x09\x09\x0a\x0a\x0b\x0c\x0d\x0d\x0e\x0f\x10\x11\x12\x13\x14"
+                          "\x15\x17\x18\x1a\x1b\x1d\x1f\x20\x22\x24\x27\x29\x2b\x2e\x31\x34"
+                          "\x37\x3a\x3e\x41\x45\x49\x4e\x52\x57\x5c\x62\x68\x6e\x75\x7c\x83"
+                          "\x8b\x93\x9c\xa5\xaf\xb9\xc4\xd0\xdd\xea\xf8\xff";
+
+// xorshift32, so the corpus doesn't depend on the standard library
+class Rng {
+public:
+    explicit Rng(uint32_t seed) : m_state(seed * 0x9e3779b9u | 1) {}
+
+    uint32_t next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+    // inclusive range
+    int  range(int lo, int hi) { return lo + next() % (hi - lo + 1); }
+    bool chance(int percent) { return (int) (next() % 100) < percent; }
+
+    // Filler for the player code. Only bytes below 0x80 are used, which
+    // excludes all opcodes of the signatures. The first freq table byte and
+    // a few signature operands are left out too.
+    uint8_t filler() {
+        for (;;) {
+            uint8_t b = next() & 0x7f;
+            if (b != 0x08 && b != 0x10 && b != 0x38 && b != 0x4c) return b;
+        }
+    }
+
+private:
+    uint32_t m_state;
+};
+
+using Bytes = std::vector<uint8_t>;
+
+void append(Bytes& dst, Bytes const& src) { dst.insert(dst.end(), src.begin(), src.end()); }
+
+Bytes column(Rng& rng, int n, int lo, int hi) {
+    Bytes col;
+    for (int i = 0; i < n; ++i) col.push_back(rng.range(lo, hi));
+    return col;
+}
+
+// Just enough of a player for -emulate: init returns right away, play reads
+// every instrument column, the first row of every table and the song and
+// pattern tables through indexed loads, like the real player does.
+struct StubLayout {
+    int              instr_count = 1;
+    std::vector<int> columns;       // addresses
+    std::vector<int> tables;
+    int              song_table  = 0;
+    int              song_count  = 0;
+    int              patt_table  = 0;
+    int              patt_count  = 0;
+};
+
+Bytes make_stub(int load, StubLayout const& l) {
+    Bytes s;
+    auto op = [&s](uint8_t op, int addr) { s.insert(s.end(), { op, uint8_t(addr & 0xff), uint8_t(addr >> 8) }); };
+    int init = load + 6;
+    int play = init + 1;
+    op(0x4c, init);
+    op(0x4c, play);
+    s.push_back(0x60);
+
+    s.insert(s.end(), { 0xa0, uint8_t(l.instr_count) });
+    for (int c : l.columns) op(0xb9, c - 1);
+    s.insert(s.end(), { 0x88, 0xd0, uint8_t(-3 - 3 * (int) l.columns.size()) });
+    s.insert(s.end(), { 0xa0, 0x01 });
+    for (int t : l.tables) op(0xb9, t - 1);
+    s.insert(s.end(), { 0xa0, 0x00 });
+    op(0xb9, l.song_table);
+    op(0xb9, l.song_table + l.song_count);
+    op(0xb9, l.patt_table);
+    op(0xb9, l.patt_table + l.patt_count);
+    s.push_back(0x60);
+    return s;
+}
+
+Bytes make_player(Rng& rng, uint32_t flags, int stub_size) {
+    // the snippets autodetect_options() looks for, 0 marks a random operand
+    static uint8_t const SNIPPETS[5][17] = {
+        { 9, 0x9d, 0, 0, 0xb9, 0, 0, 0xf0, 0, 0x9d },
+        { 12, 0xa0, 0, 0xf0, 0, 0xa9, 0, 0xd0, 0, 0xb9, 0, 0, 0xf0 },
+        { 12, 0xde, 0, 0, 0x4c, 0, 0, 0xf0, 0, 0xbd, 0, 0, 0xd0 },
+        { 16, 0xbc, 0, 0, 0xb9, 0, 0, 0x9d, 0, 0, 0xbd, 0, 0, 0xf0, 0, 0x38, 0xe9 },
+        { 8, 0xc9, 0x10, 0xb0, 0, 0xdd, 0, 0, 0xf0 },
+    };
+    // the stub is filled in once the layout is known
+    Bytes code(stub_size);
+    for (int s = 0; s < 5; ++s) {
+        for (int i = rng.range(100, 300); i > 0; --i) code.push_back(rng.filler());
+        if (flags & (1 << s)) continue;
+        for (int i = 1; i <= SNIPPETS[s][0]; ++i) {
+            uint8_t b = SNIPPETS[s][i];
+            code.push_back(b ? b : rng.filler());
+        }
+    }
+    for (int i = rng.range(60, 400); i > 0; --i) code.push_back(rng.filler());
+    code.insert(code.end(), FREQ_HI, FREQ_HI + sizeof(FREQ_HI) - 1);
+    return code;
+}
+
+} // namespace
+
+
+std::vector<uint8_t> generate_sid(uint32_t seed, uint32_t flags) {
+    Rng  rng(seed);
+    bool nopulse    = flags & GEN_NOPULSE;
+    bool nofilter   = flags & GEN_NOFILTER;
+    bool noinstrvib = flags & GEN_NOINSTRVIB;
+    bool fixed      = flags & GEN_FIXEDPARAMS;
+
+    int columns = 3 + !nopulse + !nofilter + 2 * !noinstrvib + 2 * !fixed;
+    int rows    = 2 * (2 + !nopulse + !nofilter);
+    StubLayout stub;
+    stub.columns.resize(columns);
+    stub.tables.resize(rows);
+    int   stub_size = make_stub(0, stub).size();
+    Bytes code      = make_player(rng, flags, stub_size);
+
+    int songs    = rng.range(1, 3);
+    int channels = 3;
+    int len[4]   = {
+        rng.range(1, 20),
+        nopulse ? 0 : rng.range(1, 12),
+        nofilter ? 0 : rng.range(1, 12),
+        rng.range(0, 6),
+    };
+    int instr_count = rng.range(1, 12);
+    int patt_count  = rng.range(2, 10);
+
+    // packed patterns
+    std::vector<Bytes> patterns;
+    for (int p = 0; p < patt_count; ++p) {
+        Bytes b;
+        // make sure the last instrument is used
+        if (p == 0) b = { uint8_t(instr_count), 0x60 };
+        int rows = 0;
+        for (int target = rng.range(8, 64); rows < target;) {
+            if (rng.chance(30)) b.push_back(rng.range(1, instr_count));
+            int k = rng.range(0, 9);
+            if (k < 4) {
+                b.push_back(rng.range(0x60, 0xbc));
+                rows += 1;
+            }
+            else if (k < 5) {
+                b.push_back(rng.range(0xbd, 0xbf));
+                rows += 1;
+            }
+            else if (k < 7) {
+                int n = rng.range(1, 8);
+                b.push_back(256 - n);
+                rows += n;
+            }
+            else {
+                Bytes cmds = { 0x0, 0x5, 0x6, 0x7, 0xb, 0xc, 0xd, 0xf, 0x8 };
+                if (len[3])    cmds.insert(cmds.end(), { 0x1, 0x2, 0x3, 0x4, 0xe });
+                if (!nopulse)  cmds.push_back(0x9);
+                if (!nofilter) cmds.push_back(0xa);
+                int  cmd    = cmds[rng.next() % cmds.size()];
+                bool fxonly = rng.chance(50);
+                b.push_back((fxonly ? 0x50 : 0x40) + cmd);
+                if ((cmd >= 0x1 && cmd <= 0x4) || cmd == 0xe) b.push_back(rng.range(1, len[3]));
+                else if (cmd >= 0x8 && cmd <= 0xa)            b.push_back(rng.range(1, len[cmd - 8]));
+                else if (cmd)                                 b.push_back(rng.range(0, 255));
+                if (!fxonly) b.push_back(rng.range(0x60, 0xbf));
+                rows += 1;
+            }
+        }
+        b.push_back(0);
+        patterns.push_back(b);
+    }
+
+    // order lists
+    std::vector<Bytes> orders;
+    for (int s = 0; s < songs; ++s) {
+        for (int c = 0; c < channels; ++c) {
+            Bytes o;
+            for (int i = rng.range(1, 8); i > 0; --i) {
+                if (rng.chance(20)) o.push_back(rng.range(0xe0, 0xfe));
+                o.push_back(rng.range(0, patt_count - 1));
+                if (rng.chance(20)) o.push_back(rng.range(0xd0, 0xdf));
+            }
+            // make sure the last pattern is used
+            if (s == 0 && c == 0) o.push_back(patt_count - 1);
+            o.push_back(0xff);
+            o.push_back(0);
+            orders.push_back(o);
+        }
+    }
+
+    // instrument columns
+    Bytes instr;
+    append(instr, column(rng, instr_count, 0, 255));
+    append(instr, column(rng, instr_count, 0, 255));
+    append(instr, column(rng, instr_count, 1, len[0]));
+    if (!nopulse)  append(instr, column(rng, instr_count, 0, len[1]));
+    if (!nofilter) append(instr, column(rng, instr_count, 0, len[2]));
+    if (!noinstrvib) {
+        append(instr, column(rng, instr_count, 0, len[3]));
+        append(instr, column(rng, instr_count, 0, 255));
+    }
+    if (!fixed) {
+        append(instr, column(rng, instr_count, 0, 255));
+        append(instr, column(rng, instr_count, 0, 255));
+    }
+
+    // wave, pulse and filter tables end with a jump, the speed table is
+    // framed by zeros
+    Bytes            tables;
+    std::vector<int> table_pos;
+    for (int t = 0; t < 4; ++t) {
+        if (t == 1 && nopulse) continue;
+        if (t == 2 && nofilter) continue;
+        if (t < 3) {
+            table_pos.push_back(tables.size());
+            append(tables, column(rng, len[t] - 1, 0, 0xfe));
+            tables.push_back(0xff);
+            table_pos.push_back(tables.size());
+            append(tables, column(rng, len[t], 0, 255));
+        }
+        else {
+            tables.push_back(0);
+            table_pos.push_back(tables.size());
+            append(tables, column(rng, len[t], 1, 0xef));
+            tables.push_back(0);
+            table_pos.push_back(tables.size());
+            append(tables, column(rng, len[t], 0, 255));
+        }
+    }
+
+    // positions in data, which starts with the load address
+    int const load = 0x1000;
+    int pos = 2 + code.size() + songs * channels * 2 + patt_count * 2 + instr.size() + tables.size();
+    std::vector<int> order_pos, patt_pos;
+    for (Bytes const& o : orders)   order_pos.push_back(pos), pos += o.size();
+    for (Bytes const& p : patterns) patt_pos.push_back(pos), pos += p.size();
+
+    auto addr = [](int pos) { return pos - 2 + load; };
+    int song_table = 2 + code.size();
+    int instr_pos  = song_table + songs * channels * 2 + patt_count * 2;
+    stub.instr_count = instr_count;
+    for (int c = 0; c < columns; ++c) stub.columns[c] = addr(instr_pos + c * instr_count);
+    for (int t = 0; t < rows; ++t)    stub.tables[t]  = addr(instr_pos + instr.size() + table_pos[t]);
+    stub.song_table = addr(song_table);
+    stub.song_count = songs * channels;
+    stub.patt_table = addr(song_table + songs * channels * 2);
+    stub.patt_count = patt_count;
+    Bytes player = make_stub(load, stub);
+    std::copy(player.begin(), player.end(), code.begin());
+
+    Bytes data = { load & 0xff, load >> 8 };
+    append(data, code);
+    for (int p : order_pos) data.push_back((p - 2 + load) & 0xff);
+    for (int p : order_pos) data.push_back((p - 2 + load) >> 8);
+    for (int p : patt_pos)  data.push_back((p - 2 + load) & 0xff);
+    for (int p : patt_pos)  data.push_back((p - 2 + load) >> 8);
+    append(data, instr);
+    append(data, tables);
+    for (Bytes const& o : orders)   append(data, o);
+    for (Bytes const& p : patterns) append(data, p);
+
+    // PSID v2 header, big-endian
+    Bytes sid(0x7c);
+    auto put16 = [&sid](int pos, int x) { sid[pos] = x >> 8; sid[pos + 1] = x & 0xff; };
+    memcpy(&sid[0x00], "PSID", 4);
+    put16(0x04, 2);
+    put16(0x06, 0x7c);
+    put16(0x08, 0);
+    put16(0x0a, load);
+    put16(0x0c, load + 3);
+    put16(0x0e, songs);
+    put16(0x10, 1);
+    snprintf((char*) &sid[0x16], 32, "synthetic %u", (unsigned) seed);
+    snprintf((char*) &sid[0x36], 32, "sid2sng_bench");
+    snprintf((char*) &sid[0x56], 32, "flags %02x", (unsigned) flags);
+    append(sid, data);
+    return sid;
+}
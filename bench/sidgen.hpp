@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Synthetic GoatTracker2 style sids for the benchmark. The image has the
+// layout Sid2Song expects: a player stub containing the code snippets of the
+// enabled features, the freq table, song and pattern tables, instrument
+// columns, tables, order lists and packed patterns. The same seed always
+// gives the same image, on every platform.
+enum {
+    GEN_NOPULSE     = 1,
+    GEN_NOFILTER    = 2,
+    GEN_NOINSTRVIB  = 4,
+    GEN_FIXEDPARAMS = 8,
+    GEN_NOWAVEDELAY = 16,
+    GEN_FLAG_COMBOS = 32,
+};
+
+std::vector<uint8_t> generate_sid(uint32_t seed, uint32_t flags);
@@ -0,0 +1,109 @@
+// Compares the signature scanner against the old std::regex based detection.
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+#include "sigscan.hpp"
+
+
+namespace {
+
+char const* PATTERNS[] = {
+    R"((\x95.|\x9d..|\xfe..)\xb9..\xf0.\x9d)",
+    R"(\xa0.\xf0.(\xa9.\xd0.)?\xb9..\xf0)",
+    R"(\xde..\x4c..\xf0.\xbd..\xd0)",
+    R"(\xbc..\xb9..\x9d..\xbd..\xf0.\x38\xe9)",
+    R"(\xc9\x10\xb0.\xdd..\xf0)",
+};
+
+constexpr sig::Signature SIGS[] = {
+    sig::compile(R"((\x95.|\x9d..|\xfe..)\xb9..\xf0.\x9d)"),
+    sig::compile(R"(\xa0.\xf0.(\xa9.\xd0.)?\xb9..\xf0)"),
+    sig::compile(R"(\xde..\x4c..\xf0.\xbd..\xd0)"),
+    sig::compile(R"(\xbc..\xb9..\x9d..\xbd..\xf0.\x38\xe9)"),
+    sig::compile(R"(\xc9\x10\xb0.\xdd..\xf0)"),
+};
+
+// the detection as it was done before, one regex search per feature
+bool re_search(std::vector<uint8_t> const& buf, const std::string& re) {
+    std::string data(buf.begin(), buf.end());
+    std::string ppre;
+    ppre = std::regex_replace(re, std::regex(R"(\.)"), R"([\d\D])");
+    std::regex regex(ppre, std::regex_constants::ECMAScript | std::regex_constants::nosubs);
+    return std::regex_search(data, regex);
+}
+
+// random player-sized image, only some features present
+std::vector<uint8_t> make_image(int size, uint32_t features, std::mt19937& rng) {
+    std::vector<uint8_t> buf(size);
+    for (uint8_t& b : buf) b = rng();
+    uint8_t const snippets[5][16] = {
+        { 9, 0x9d, 0x00, 0x00, 0xb9, 0x00, 0x00, 0xf0, 0x00, 0x9d },
+        { 12, 0xa0, 0x00, 0xf0, 0x00, 0xa9, 0x00, 0xd0, 0x00, 0xb9, 0x00, 0x00, 0xf0 },
+        { 12, 0xde, 0x00, 0x00, 0x4c, 0x00, 0x00, 0xf0, 0x00, 0xbd, 0x00, 0x00, 0xd0 },
+        { 15, 0xbc, 0x00, 0x00, 0xb9, 0x00, 0x00, 0x9d, 0x00, 0x00, 0xbd, 0x00, 0x00, 0xf0, 0x00, 0x38 },
+        { 8, 0xc9, 0x10, 0xb0, 0x00, 0xdd, 0x00, 0x00, 0xf0 },
+    };
+    for (int s = 0; s < 5; ++s) {
+        if (!(features & (1 << s))) continue;
+        int len = snippets[s][0];
+        int pos = rng() % (size - 16);
+        std::copy(snippets[s] + 1, snippets[s] + 1 + len, buf.begin() + pos);
+        if (s == 3) buf[pos + len] = 0xe9;
+    }
+    return buf;
+}
+
+template <class F>
+double time_ms(int iterations, F f) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) f();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+} // namespace
+
+
+int main() {
+    static constexpr sig::Scanner<5> scanner(SIGS);
+    static_assert(scanner.valid(), "invalid signature");
+
+    std::mt19937 rng(1234);
+    std::vector<std::vector<uint8_t>> images;
+    for (uint32_t f = 0; f < 32; ++f) images.push_back(make_image(8192, f, rng));
+
+    // both implementations have to agree
+    for (auto const& img : images) {
+        uint32_t expect = 0;
+        for (int s = 0; s < 5; ++s) expect |= re_search(img, PATTERNS[s]) << s;
+        uint32_t found = scanner.scan(img.data(), img.size());
+        if (found != expect) {
+            printf("ERROR: mismatch %02X != %02X\n", found, expect);
+            return 1;
+        }
+    }
+
+    int const regex_iter = 4;
+    int const scan_iter  = 2000;
+    uint32_t sink = 0;
+    double regex_ms = time_ms(regex_iter, [&] {
+        for (auto const& img : images) {
+            for (char const* re : PATTERNS) sink += re_search(img, re);
+        }
+    });
+    double scan_ms = time_ms(scan_iter, [&] {
+        for (auto const& img : images) sink += scanner.scan(img.data(), img.size());
+    });
+
+    double n = images.size();
+    double regex_us = regex_ms * 1000 / (regex_iter * n);
+    double scan_us  = scan_ms * 1000 / (scan_iter * n);
+    printf("autodetect, %d images of %d bytes\n", (int) images.size(), (int) images[0].size());
+    printf(" regex:   %10.2f us/image\n", regex_us);
+    printf(" scanner: %10.2f us/image\n", scan_us);
+    printf(" speedup: %10.1fx\n", regex_us / scan_us);
+    return sink == 0xffffffff;
+}
@@ -0,0 +1,321 @@
+#include "archive.hpp"
+#include <algorithm>
+#include <cstring>
+#include "bytes.hpp"
+#include "inflate.hpp"
+
+
+namespace {
+
+enum {
+    TAR_BLOCK          = 512,
+    ZIP_EOCD_SIZE      = 22,
+    ZIP_MAX_COMMENT    = 0xffff,
+    ZIP_CDIR_SIZE      = 46,
+    ZIP_LOCAL_SIZE     = 30,
+    ZIP64_LOCATOR_SIZE = 20,
+    ZIP64_EOCD_SIZE    = 56,
+    // deflate can't expand data more than this, bigger sizes are damaged
+    MAX_DEFLATE_RATIO  = 1032,
+    // far above any sid, like the worker's record limit; the size of a
+    // member is not to be trusted before it's unpacked
+    MAX_MEMBER_SIZE    = 16 << 20,
+};
+
+enum : uint32_t {
+    ZIP_LOCAL_SIG   = 0x04034b50,
+    ZIP_CDIR_SIG    = 0x02014b50,
+    ZIP_EOCD_SIG    = 0x06054b50,
+    ZIP64_LOC_SIG   = 0x07064b50,
+    ZIP64_EOCD_SIG  = 0x06064b50,
+};
+
+
+bool fail(std::string* error, char const* msg) {
+    if (error) *error = msg;
+    return false;
+}
+
+
+// numeric tar field: octal text, or big-endian binary after a 0x80 byte
+bool tar_number(uint8_t const* p, int n, uint64_t& x) {
+    x = 0;
+    if (p[0] & 0x80) {
+        if (p[0] != 0x80) return false;
+        for (int i = 1; i < n; ++i) {
+            if (x >> 56) return false;
+            x = x << 8 | p[i];
+        }
+        return true;
+    }
+    int i = 0;
+    while (i < n && p[i] == ' ') ++i;
+    for (; i < n && p[i] >= '0' && p[i] <= '7'; ++i) {
+        if (x >> 61) return false;
+        x = x << 3 | (p[i] - '0');
+    }
+    return i == n || p[i] == ' ' || p[i] == '\0';
+}
+
+std::string tar_string(uint8_t const* p, size_t n) {
+    return std::string((char const*) p, strnlen((char const*) p, n));
+}
+
+bool tar_header_ok(uint8_t const* h) {
+    uint64_t stored;
+    if (!tar_number(h + 148, 8, stored)) return false;
+    // the checksum field itself counts as spaces
+    uint64_t sum = 8 * ' ';
+    for (int i = 0; i < TAR_BLOCK; ++i) sum += i >= 148 && i < 156 ? 0 : h[i];
+    return sum == stored;
+}
+
+// the path from the "length key=value\n" records of a pax header
+std::string pax_path(ByteSpan data) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t len = 0, i = pos;
+        while (i < data.size() && data[i] >= '0' && data[i] <= '9' && len <= data.size()) {
+            len = len * 10 + (data[i++] - '0');
+        }
+        if (i >= data.size() || data[i] != ' ' || len <= i + 1 - pos || len > data.size() - pos) break;
+        char const* rec  = (char const*) data.data() + i + 1;
+        size_t      size = pos + len - (i + 1) - 1;    // without the newline
+        if (size >= 5 && memcmp(rec, "path=", 5) == 0) return std::string(rec + 5, size - 5);
+        pos += len;
+    }
+    return {};
+}
+
+} // namespace
+
+
+bool Archive::open(char const* filename, std::string* error) {
+    m_members.clear();
+    if (!m_file.open(filename)) return fail(error, "could not open file");
+    ByteSpan data = m_file.span();
+
+    // a zip file ends with the end of central directory record and a comment
+    if (data.size() >= ZIP_EOCD_SIZE) {
+        size_t last  = data.size() - ZIP_EOCD_SIZE;
+        size_t first = last > ZIP_MAX_COMMENT ? last - ZIP_MAX_COMMENT : 0;
+        for (size_t i = last + 1; i-- > first;) {
+            uint8_t const* p = data.data() + i;
+            if (get32(p) == ZIP_EOCD_SIG && i + ZIP_EOCD_SIZE + get16(p + 20) == data.size()) {
+                m_zip = true;
+                return open_zip(i, error);
+            }
+        }
+    }
+    if (data.size() >= TAR_BLOCK && tar_header_ok(data.data())) {
+        m_zip = false;
+        return open_tar(error);
+    }
+    return fail(error, "not a tar or zip file");
+}
+
+
+bool Archive::open_tar(std::string* error) {
+    ByteSpan    data = m_file.span();
+    std::string long_name;      // from a GNU or pax header for the next member
+    uint64_t    pos = 0;
+    while (data.size() - pos >= TAR_BLOCK) {
+        uint8_t const* h = data.data() + pos;
+        // the archive ends with zero blocks
+        if (std::all_of(h, h + TAR_BLOCK, [](uint8_t b) { return b == 0; })) break;
+        uint64_t size;
+        if (!tar_header_ok(h) || !tar_number(h + 124, 12, size)) return fail(error, "bad tar header");
+        uint64_t offset = pos + TAR_BLOCK;
+        if (size > data.size() - offset) return fail(error, "tar member past the end of the file");
+
+        char type = h[156];
+        if (type == 'L') {
+            long_name = tar_string(data.data() + offset, size);
+        }
+        else if (type == 'x') {
+            std::string path = pax_path(data.subspan(offset, size));
+            if (!path.empty()) long_name = path;
+        }
+        else if (type != 'K' && type != 'g') {
+            // only regular files, '7' is contiguous
+            if (type == '0' || type == '\0' || type == '7') {
+                Member m;
+                if (!long_name.empty()) {
+                    m.name = long_name;
+                }
+                else {
+                    m.name = tar_string(h, 100);
+                    if (memcmp(h + 257, "ustar", 5) == 0 && h[345]) {
+                        m.name = tar_string(h + 345, 155) + "/" + m.name;
+                    }
+                }
+                m.offset      = offset;
+                m.packed_size = size;
+                m.size        = size;
+                m_members.push_back(std::move(m));
+            }
+            long_name.clear();
+        }
+        pos = offset + (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+        if (pos > data.size()) break;
+    }
+    return true;
+}
+
+
+bool Archive::open_zip(size_t eocd, std::string* error) {
+    ByteSpan       data = m_file.span();
+    uint8_t const* e    = data.data() + eocd;
+    uint64_t count      = get16(e + 10);
+    uint64_t cdir_size  = get32(e + 12);
+    uint64_t cdir       = get32(e + 16);
+    // zip64 keeps the real values in another record, found through a
+    // locator right before this one
+    if ((count == 0xffff || cdir_size == 0xffffffff || cdir == 0xffffffff) && eocd >= ZIP64_LOCATOR_SIZE &&
+        get32(e - ZIP64_LOCATOR_SIZE) == ZIP64_LOC_SIG) {
+        uint64_t z = get64(e - ZIP64_LOCATOR_SIZE + 8);
+        if (z > data.size() || data.size() - z < ZIP64_EOCD_SIZE || get32(data.data() + z) != ZIP64_EOCD_SIG) {
+            return fail(error, "bad zip64 end record");
+        }
+        count     = get64(data.data() + z + 32);
+        cdir_size = get64(data.data() + z + 40);
+        cdir      = get64(data.data() + z + 48);
+    }
+    if (cdir > data.size() || cdir_size > data.size() - cdir) return fail(error, "bad zip central directory");
+
+    uint8_t const* p   = data.data() + cdir;
+    uint8_t const* end = p + cdir_size;
+    for (uint64_t i = 0; i < count; ++i) {
+        if (end - p < ZIP_CDIR_SIZE || get32(p) != ZIP_CDIR_SIG) return fail(error, "bad zip central directory");
+        int      flags       = get16(p + 8);
+        int      method      = get16(p + 10);
+        uint32_t crc         = get32(p + 16);
+        uint64_t packed_size = get32(p + 20);
+        uint64_t size        = get32(p + 24);
+        int      name_len    = get16(p + 28);
+        int      extra_len   = get16(p + 30);
+        int      comment_len = get16(p + 32);
+        uint64_t local       = get32(p + 42);
+        if (end - p - ZIP_CDIR_SIZE < name_len + extra_len + comment_len) {
+            return fail(error, "bad zip central directory");
+        }
+        std::string name((char const*) p + ZIP_CDIR_SIZE, name_len);
+
+        // zip64 extra field: the values that didn't fit, in this order
+        uint8_t const* x     = p + ZIP_CDIR_SIZE + name_len;
+        uint8_t const* x_end = x + extra_len;
+        while (x_end - x >= 4) {
+            int id  = get16(x);
+            int len = get16(x + 2);
+            if (x_end - x - 4 < len) break;
+            uint8_t const* f     = x + 4;
+            uint8_t const* f_end = f + len;
+            if (id == 1) {
+                if (size == 0xffffffff && f_end - f >= 8)        size = get64(f), f += 8;
+                if (packed_size == 0xffffffff && f_end - f >= 8) packed_size = get64(f), f += 8;
+                if (local == 0xffffffff && f_end - f >= 8)       local = get64(f), f += 8;
+            }
+            x = f_end;
+        }
+        p += ZIP_CDIR_SIZE + name_len + extra_len + comment_len;
+        if (!name.empty() && name.back() == '/') continue;
+
+        // the local header's name and extra field may differ from the
+        // central directory's, only its sizes say where the data starts
+        if (data.size() < ZIP_LOCAL_SIZE || local > data.size() - ZIP_LOCAL_SIZE ||
+            get32(data.data() + local) != ZIP_LOCAL_SIG) {
+            return fail(error, "bad zip local header");
+        }
+        uint8_t const* l      = data.data() + local;
+        uint64_t       offset = local + ZIP_LOCAL_SIZE + get16(l + 26) + get16(l + 28);
+        if (offset > data.size() || packed_size > data.size() - offset) {
+            return fail(error, "zip member past the end of the file");
+        }
+        Member m;
+        m.name        = std::move(name);
+        m.offset      = offset;
+        m.packed_size = packed_size;
+        m.size        = size;
+        m.crc         = crc;
+        m.method      = flags & 1 ? ENCRYPTED : method;
+        m_members.push_back(std::move(m));
+    }
+    return true;
+}
+
+
+bool Archive::read(Member const& member, std::vector<uint8_t>& buffer, ByteSpan& data, std::string* error) const {
+    if (member.size > MAX_MEMBER_SIZE) return fail(error, "member too big");
+    ByteSpan packed = m_file.span().subspan(member.offset, member.packed_size);
+    if (member.method == STORED) {
+        if (member.size != packed.size()) return fail(error, "bad member size");
+        data = packed;
+    }
+    else if (member.method == DEFLATED) {
+        if (member.size / MAX_DEFLATE_RATIO > packed.size()) return fail(error, "bad member size");
+        buffer.resize(member.size);
+        if (!inflate(packed, buffer.data(), buffer.size())) return fail(error, "damaged deflate data");
+        data = ByteSpan(buffer.data(), buffer.size());
+    }
+    else {
+        return fail(error, member.method == ENCRYPTED ? "encrypted member" : "unsupported compression method");
+    }
+    if (m_zip && crc32(data) != member.crc) return fail(error, "CRC mismatch");
+    return true;
+}
+
+
+namespace {
+
+// the end of the pattern element at p if it matches c, else nullptr
+char const* match_char(char const* p, unsigned char c) {
+    if (*p == '\0') return nullptr;
+    if (*p == '?') return p + 1;
+    if (*p == '[') {
+        char const* q      = p + 1;
+        bool        negate = *q == '!';
+        q += negate;
+        // a ']' right after the '[' is part of the set
+        char const* first = q;
+        bool        found = false;
+        while (*q && (*q != ']' || q == first)) {
+            unsigned char lo = q[0];
+            if (q[1] == '-' && q[2] && q[2] != ']') {
+                found |= c >= lo && c <= (unsigned char) q[2];
+                q += 3;
+            }
+            else {
+                found |= c == lo;
+                ++q;
+            }
+        }
+        if (*q == ']') return found != negate ? q + 1 : nullptr;
+        // without the closing bracket, '[' is a plain character
+    }
+    return (unsigned char) *p == c ? p + 1 : nullptr;
+}
+
+} // namespace
+
+bool glob_match(char const* pattern, char const* name) {
+    // on a mismatch, the last '*' takes one more character
+    char const* star  = nullptr;
+    char const* retry = nullptr;
+    while (*name) {
+        if (*pattern == '*') {
+            star  = ++pattern;
+            retry = name;
+            continue;
+        }
+        if (char const* next = match_char(pattern, *name)) {
+            pattern = next;
+            ++name;
+            continue;
+        }
+        if (!star) return false;
+        pattern = star;
+        name    = ++retry;
+    }
+    while (*pattern == '*') ++pattern;
+    return *pattern == '\0';
+}
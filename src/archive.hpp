@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mapfile.hpp"
+
+// Members of a tar or zip file, read memory mapped. Tar members and stored
+// zip members are handed out in place; deflated ones are unpacked into a
+// buffer of the caller, so several threads can read members at once.
+// Directories, links and other special members are left out.
+class Archive {
+public:
+    enum Method {
+        STORED    = 0,
+        DEFLATED  = 8,
+        ENCRYPTED = -1,
+    };
+
+    struct Member {
+        std::string name;           // as stored, '/' separated
+        uint64_t    offset = 0;     // of the data in the archive
+        uint64_t    packed_size = 0;
+        uint64_t    size   = 0;
+        uint32_t    crc    = 0;     // zip only
+        int         method = STORED;   // Method or another zip method
+    };
+
+    // false if the file is neither a tar nor a zip file, or damaged
+    bool open(char const* filename, std::string* error = nullptr);
+
+    std::vector<Member> const& members() const { return m_members; }
+
+    // data receives the member's bytes, which stay valid as long as the
+    // archive and buffer do
+    bool read(Member const& member, std::vector<uint8_t>& buffer, ByteSpan& data,
+              std::string* error = nullptr) const;
+
+private:
+    bool open_tar(std::string* error);
+    bool open_zip(size_t eocd, std::string* error);
+
+    MappedFile          m_file;
+    std::vector<Member> m_members;
+    bool                m_zip = false;
+};
+
+// Shell style match of a whole name: '*' matches any run of characters,
+// including '/', '?' one character and [a-z] or [!a-z] a set of them.
+bool glob_match(char const* pattern, char const* name);
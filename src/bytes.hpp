@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Little-endian numbers of the file formats, and the FNV-1a hash of sids,
+// players and patterns.
+
+inline uint16_t get16(uint8_t const* p) {
+    return p[0] | p[1] << 8;
+}
+
+inline uint32_t get32(uint8_t const* p) {
+    return get16(p) | uint32_t(get16(p + 2)) << 16;
+}
+
+inline uint64_t get64(uint8_t const* p) {
+    return get32(p) | uint64_t(get32(p + 4)) << 32;
+}
+
+inline void put32(uint8_t* p, uint32_t x) {
+    for (int i = 0; i < 4; ++i) p[i] = x >> i * 8;
+}
+
+inline void put64(uint8_t* p, uint64_t x) {
+    for (int i = 0; i < 8; ++i) p[i] = x >> i * 8;
+}
+
+
+enum : uint64_t {
+    FNV_BASIS = 0xcbf29ce484222325ull,
+    FNV_PRIME = 0x100000001b3ull,
+};
+
+// continues from h, which some callers seed with a length
+inline uint64_t fnv1a(uint8_t const* data, size_t size, uint64_t h = FNV_BASIS) {
+    for (size_t i = 0; i < size; ++i) {
+        h ^= data[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
@@ -0,0 +1,94 @@
+#include "compactsong.hpp"
+#include <cstring>
+
+
+// The arena starts with one offset per order list, then one per pattern,
+// each pointing at the data behind the length byte in the image.
+
+bool gt::CompactSong::load(uint8_t const* data, size_t size, std::string* error) {
+    ImageIndex index;
+    if (!index_image(data, size, index, error)) return false;
+
+    // one allocation of the exact size
+    int    count = index.songs * index.channels + index.patterns;
+    size_t image = count * sizeof(uint32_t);
+    std::vector<uint8_t> arena(image + size);
+
+    uint8_t* offsets = arena.data();
+    auto put = [&offsets](uint32_t x) {
+        memcpy(offsets, &x, sizeof(x));
+        offsets += sizeof(x);
+    };
+    for (int d = 0; d < index.songs; d++) {
+        for (int c = 0; c < index.channels; c++) put(image + index.order[d][c].offset);
+    }
+    for (int c = 0; c < index.patterns; c++) put(image + index.pattern[c].offset);
+    memcpy(arena.data() + image, data, size);
+
+    m_arena.swap(arena);
+    m_image = image;
+    m_instr = image + index.instr.offset;
+    for (int t = 0; t < MAX_TABLES; t++) m_table[t] = image + index.table[t].offset;
+    m_channels    = index.channels;
+    m_songs       = index.songs;
+    m_patterns    = index.patterns;
+    m_instruments = index.instr.size / sizeof(Instr);
+    return true;
+}
+
+void gt::CompactSong::assign(Song& song) {
+    std::vector<uint8_t> image;
+    song.save(image);
+    // saved images always index
+    load(image.data(), image.size());
+}
+
+
+void gt::CompactSong::save(std::vector<uint8_t>& image) const {
+    ByteSpan img = this->image();
+    image.assign(img.begin(), img.end());
+}
+
+bool gt::CompactSong::save(char const* filename) const {
+    FILE* file = fopen(filename, "wb");
+    if (!file) return false;
+    ByteSpan img = image();
+    bool ok = fwrite(img.data(), 1, img.size(), file) == img.size();
+    return fclose(file) == 0 && ok;
+}
+
+bool gt::CompactSong::to_song(Song& song) const {
+    ByteSpan img = image();
+    return song.load(img.data(), img.size());
+}
+
+
+uint32_t gt::CompactSong::offset(int i) const {
+    uint32_t o;
+    memcpy(&o, m_arena.data() + i * sizeof(uint32_t), sizeof(o));
+    return o;
+}
+
+ByteSpan gt::CompactSong::order_list(int song, int chn) const {
+    uint32_t o = offset(song * m_channels + chn);
+    return { m_arena.data() + o, size_t(m_arena[o - 1] + 1) };
+}
+
+ByteSpan gt::CompactSong::pattern(int patt) const {
+    uint32_t o = offset(m_songs * m_channels + patt);
+    return { m_arena.data() + o, size_t(m_arena[o - 1] * 4) };
+}
+
+gt::Instr const& gt::CompactSong::instr(int num) const {
+    return *(Instr const*) (m_arena.data() + m_instr + (num - 1) * sizeof(Instr));
+}
+
+ByteSpan gt::CompactSong::ltable(int t) const {
+    uint32_t o = m_table[t];
+    return { m_arena.data() + o, m_arena[o - 1] };
+}
+
+ByteSpan gt::CompactSong::rtable(int t) const {
+    uint32_t o = m_table[t];
+    return { m_arena.data() + o + m_arena[o - 1], m_arena[o - 1] };
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "gsong.hpp"
+#include "mapfile.hpp"
+
+namespace gt {
+
+// Read-only song that only takes the memory its content needs, for keeping
+// many decoded songs at once. One arena holds the offsets of the order lists
+// and patterns, followed by the GTS5 image, so unused patterns, songs,
+// instruments and table entries cost nothing and saving is a plain copy. A
+// typical tune needs a few KB instead of the ~190 KB of a Song.
+// sid2sng::Converter converts into one through its scratch Song.
+class CompactSong {
+public:
+    bool load(uint8_t const* data, size_t size, std::string* error = nullptr);
+    void assign(Song& song);
+
+    void save(std::vector<uint8_t>& image) const;
+    bool save(char const* filename) const;
+    bool to_song(Song& song) const;
+
+    int channels() const { return m_channels; }
+    int songs() const { return m_songs; }
+    int patterns() const { return m_patterns; }
+    int instruments() const { return m_instruments; }
+
+    // order list of a channel, up to and including the restart position
+    ByteSpan     order_list(int song, int chn) const;
+    // pattern rows, 4 bytes each, including the ENDPATT row
+    ByteSpan     pattern(int patt) const;
+    // instruments are numbered from 1
+    Instr const& instr(int num) const;
+    ByteSpan     ltable(int t) const;
+    ByteSpan     rtable(int t) const;
+
+    ByteSpan image() const { return { m_arena.data() + m_image, m_arena.size() - m_image }; }
+    size_t   memory_size() const { return sizeof(*this) + m_arena.capacity(); }
+
+private:
+    uint32_t offset(int i) const;
+
+    std::vector<uint8_t> m_arena;
+    uint32_t             m_image = 0;
+    uint32_t             m_instr = 0;
+    uint32_t             m_table[MAX_TABLES] = {};
+    uint8_t              m_channels    = 0;
+    uint8_t              m_songs       = 0;
+    uint8_t              m_patterns    = 0;
+    uint8_t              m_instruments = 0;
+};
+
+} // namespace gt
@@ -0,0 +1,166 @@
+#include "convertcache.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include "bytes.hpp"
+
+
+namespace fs = std::filesystem;
+
+// Entry files start with a header of little-endian uint32s:
+//   magic, format, sid size, features, warnings, log size, sng size
+// followed by the sid, the log and the GTS5 image.
+static char const ENTRY_MAGIC[4]  = { 'S', '2', 'S', 'C' };
+static uint32_t const ENTRY_FORMAT = 2;
+static char const ENTRY_EXT[]     = ".s2sc";
+
+enum {
+    HEADER_FIELDS = 7,
+    HEADER_SIZE   = HEADER_FIELDS * 4,
+};
+
+
+bool ConvertCache::open(char const* dir, uint64_t max_size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (!fs::is_directory(dir, ec)) return false;
+    m_dir      = dir;
+    m_max_size = max_size;
+    m_size     = 0;
+    m_tmp_id   = std::random_device()();
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() == ENTRY_EXT) m_size += it->file_size(ec);
+    }
+    return !ec;
+}
+
+
+uint64_t ConvertCache::key(ByteSpan sid, uint64_t salt) {
+    // FNV-1a, seeded with the length and the salt
+    uint8_t seed[8];
+    put64(seed, salt);
+    return fnv1a(sid.data(), sid.size(), fnv1a(seed, 8, FNV_BASIS ^ sid.size()));
+}
+
+
+std::string ConvertCache::filename(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016" PRIx64, key);
+    return m_dir + name + ENTRY_EXT;
+}
+
+
+bool ConvertCache::lookup(uint64_t key, ByteSpan sid, Entry& entry) {
+    std::string name = filename(key);
+    MappedFile  file;
+    bool       ok = file.open(name.c_str());
+    ByteSpan   data = file.span();
+    uint8_t const* p = data.data();
+    ok = ok && data.size() >= HEADER_SIZE && memcmp(p, ENTRY_MAGIC, 4) == 0
+            && get32(p + 4) == ENTRY_FORMAT && get32(p + 8) == sid.size();
+    if (ok) {
+        uint32_t log_size = get32(p + 20);
+        uint32_t sng_size = get32(p + 24);
+        ok = data.size() == HEADER_SIZE + uint64_t(sid.size()) + log_size + sng_size
+          && (sid.empty() || memcmp(p + HEADER_SIZE, sid.data(), sid.size()) == 0);
+        if (ok) {
+            uint8_t const* log = p + HEADER_SIZE + sid.size();
+            entry.features = get32(p + 12);
+            entry.warnings = get32(p + 16);
+            entry.log.assign((char const*) log, log_size);
+            entry.sng.assign(log + log_size, p + data.size());
+        }
+    }
+    file.close();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!ok) {
+        ++m_misses;
+        return false;
+    }
+    ++m_hits;
+    // recently used entries are evicted last
+    std::error_code ec;
+    fs::last_write_time(name, fs::file_time_type::clock::now(), ec);
+    return true;
+}
+
+
+void ConvertCache::insert(uint64_t key, ByteSpan sid, uint32_t features, uint32_t warnings,
+                          std::string const& log, ByteSpan sng) {
+    uint32_t const fields[HEADER_FIELDS - 1] = {
+        ENTRY_FORMAT, uint32_t(sid.size()), features, warnings, uint32_t(log.size()), uint32_t(sng.size()),
+    };
+    uint8_t buf[HEADER_SIZE];
+    memcpy(buf, ENTRY_MAGIC, 4);
+    for (int i = 0; i < HEADER_FIELDS - 1; ++i) put32(buf + 4 + i * 4, fields[i]);
+
+    std::string name = filename(key);
+    std::string tmp  = name + "." + std::to_string(m_tmp_id++) + ".tmp";
+    FILE* file = fopen(tmp.c_str(), "wb");
+    if (!file) return;
+    bool ok = fwrite(buf, 1, HEADER_SIZE, file) == HEADER_SIZE
+           && fwrite(sid.data(), 1, sid.size(), file) == sid.size()
+           && fwrite(log.data(), 1, log.size(), file) == log.size()
+           && fwrite(sng.data(), 1, sng.size(), file) == sng.size();
+    ok = fclose(file) == 0 && ok;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::error_code ec;
+    // another thread or process may have stored the same entry meanwhile
+    uint64_t old = fs::file_size(name, ec);
+    if (ec) old = 0;
+#ifdef _WIN32
+    // rename doesn't replace existing files on windows
+    if (ok) remove(name.c_str());
+#endif
+    if (!ok || rename(tmp.c_str(), name.c_str()) != 0) {
+        remove(tmp.c_str());
+        return;
+    }
+    m_size += HEADER_SIZE + sid.size() + log.size() + sng.size() - old;
+    if (m_size > m_max_size) evict();
+}
+
+
+// Removes the oldest entries until the cache is a bit below its limit, so
+// this doesn't run again on the next insert. Called with the mutex held.
+void ConvertCache::evict() {
+    struct File {
+        fs::file_time_type time;
+        uint64_t           size;
+        fs::path           path;
+    };
+    std::vector<File> files;
+    std::error_code   ec;
+    m_size = 0;
+    for (fs::directory_iterator it(m_dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() != ENTRY_EXT) continue;
+        File f = { it->last_write_time(ec), it->file_size(ec), it->path() };
+        if (ec) {
+            // removed by someone else
+            ec.clear();
+            continue;
+        }
+        m_size += f.size;
+        files.push_back(std::move(f));
+    }
+    std::sort(files.begin(), files.end(), [](File const& a, File const& b) { return a.time < b.time; });
+    uint64_t target = m_max_size - m_max_size / 8;
+    for (File const& f : files) {
+        if (m_size <= target) break;
+        if (fs::remove(f.path, ec)) ++m_evictions;
+        m_size -= f.size;
+    }
+}
+
+
+uint64_t ConvertCache::size() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
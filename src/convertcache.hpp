@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "mapfile.hpp"
+
+// Directory of finished conversions, one file per entry, named by a hash of
+// the sid, the options that affect the output and the converter version. An
+// entry holds the GTS5 image along with the features, warnings and log of the
+// conversion, so a hit skips the converter entirely. It also holds the sid,
+// which has to match, so a hash collision is a miss rather than a wrong song.
+// Past the size limit, the least recently used entries are removed; hits
+// refresh the file time.
+// Lookups and inserts may come from several threads.
+class ConvertCache {
+public:
+    struct Entry {
+        uint32_t             features = 0;
+        uint32_t             warnings = 0;
+        std::string          log;
+        std::vector<uint8_t> sng;
+    };
+
+    // Creates the directory if needed and adds up the size of its entries.
+    // Call before any lookups.
+    bool open(char const* dir, uint64_t max_size);
+
+    // salt covers everything besides the sid that the output depends on
+    static uint64_t key(ByteSpan sid, uint64_t salt);
+
+    bool lookup(uint64_t key, ByteSpan sid, Entry& entry);
+    // A failed write only costs the entry, so there's no error.
+    void insert(uint64_t key, ByteSpan sid, uint32_t features, uint32_t warnings,
+                std::string const& log, ByteSpan sng);
+
+    uint64_t size();
+    int      hits() const { return m_hits; }
+    int      misses() const { return m_misses; }
+    int      evictions() const { return m_evictions; }
+
+private:
+    std::string filename(uint64_t key) const;
+    void        evict();
+
+    std::mutex            m_mutex;
+    std::string           m_dir;
+    uint64_t              m_max_size  = 0;
+    uint64_t              m_size      = 0;
+    std::atomic<uint32_t> m_tmp_id{ 0 };    // unique temporary names across processes
+    int                   m_hits      = 0;
+    int                   m_misses    = 0;
+    int                   m_evictions = 0;
+};
@@ -0,0 +1,355 @@
+#include "cpu6502.hpp"
+#include <cstring>
+
+
+namespace {
+
+enum {
+    FLAG_C = 0x01,
+    FLAG_Z = 0x02,
+    FLAG_I = 0x04,
+    FLAG_D = 0x08,
+    FLAG_B = 0x10,
+    FLAG_U = 0x20,
+    FLAG_V = 0x40,
+    FLAG_N = 0x80,
+};
+
+// base cycles per opcode, without page crossing penalties; 0 = unsupported
+uint8_t const CYCLES[256] = {
+//  0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f
+    7, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 0, 4, 6, 0, // 0
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 1
+    6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0, // 2
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 3
+    6, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 3, 4, 6, 0, // 4
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 5
+    6, 6, 0, 0, 0, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0, // 6
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 7
+    0, 6, 0, 0, 3, 3, 3, 0, 2, 0, 2, 0, 4, 4, 4, 0, // 8
+    2, 6, 0, 0, 4, 4, 4, 0, 2, 5, 2, 0, 0, 5, 0, 0, // 9
+    2, 6, 2, 0, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0, // a
+    2, 5, 0, 0, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0, // b
+    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0, // c
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // d
+    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0, // e
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // f
+};
+
+} // namespace
+
+
+Cpu6502::Cpu6502() {
+    memset(mem, 0, sizeof(mem));
+    clear_trace();
+}
+
+void Cpu6502::load(uint16_t addr, uint8_t const* data, size_t size) {
+    if (size > sizeof(mem) - addr) size = sizeof(mem) - addr;
+    memcpy(mem + addr, data, size);
+}
+
+void Cpu6502::clear_trace() {
+    memset(m_trace, 0, sizeof(m_trace));
+}
+
+
+bool Cpu6502::call(uint16_t addr, uint8_t a_in, int max_cycles) {
+    // registers live in locals while running
+    uint8_t* const  m     = mem;
+    uint64_t* const trace = m_trace;
+    uint16_t pc = addr;
+    uint8_t  a  = a_in;
+    uint8_t  x  = m_x;
+    uint8_t  y  = m_y;
+    uint8_t  sp = m_sp;
+    uint8_t  p  = m_p;
+    int64_t  cycles = 0;
+    bool     done   = false;
+
+    // the call returns when an rts pops the fake return address
+    uint16_t ret = 0xffff;
+    m[0x100 + sp--] = ret >> 8;
+    m[0x100 + sp--] = ret & 0xff;
+    uint8_t const sp_top = sp + 2;
+
+    auto nz     = [&](uint8_t v) { p = (p & ~(FLAG_N | FLAG_Z)) | (v & FLAG_N) | (v ? 0 : FLAG_Z); return v; };
+    auto push   = [&](uint8_t v) { m[0x100 + sp--] = v; };
+    auto pull   = [&]() { return m[0x100 + ++sp]; };
+    auto fetch  = [&]() { return m[pc++]; };
+    auto fetch2 = [&]() { uint16_t v = m[pc] | m[uint16_t(pc + 1)] << 8; pc += 2; return v; };
+    auto zp16   = [&](uint8_t z) { return uint16_t(m[z] | m[uint8_t(z + 1)] << 8); };
+    auto mark   = [&](uint16_t base) { trace[base >> 6] |= uint64_t(1) << (base & 63); };
+
+    // effective addresses
+    auto zp   = [&]() -> uint16_t { return fetch(); };
+    auto zpx  = [&]() -> uint16_t { return uint8_t(fetch() + x); };
+    auto zpy  = [&]() -> uint16_t { return uint8_t(fetch() + y); };
+    auto abs  = [&]() -> uint16_t { return fetch2(); };
+    auto absx = [&]() -> uint16_t { return fetch2() + x; };
+    auto absy = [&]() -> uint16_t { return fetch2() + y; };
+    auto indx = [&]() -> uint16_t { return zp16(uint8_t(fetch() + x)); };
+    auto indy = [&]() -> uint16_t { return zp16(fetch()) + y; };
+    // the same for loads, which are traced
+    auto ldx  = [&]() -> uint16_t { uint16_t b = fetch2(); mark(b); return b + x; };
+    auto ldy  = [&]() -> uint16_t { uint16_t b = fetch2(); mark(b); return b + y; };
+    auto ldiy = [&]() -> uint16_t { uint16_t b = zp16(fetch()); mark(b); return b + y; };
+
+    auto adc = [&](uint8_t v) {
+        int c = p & FLAG_C;
+        if (p & FLAG_D) {
+            int lo = (a & 0x0f) + (v & 0x0f) + c;
+            int hi = (a & 0xf0) + (v & 0xf0);
+            if (lo > 0x09) { lo += 0x06; hi += 0x10; }
+            p &= ~(FLAG_V | FLAG_C);
+            if (~(a ^ v) & (a ^ hi) & 0x80) p |= FLAG_V;
+            if (hi > 0x90) hi += 0x60;
+            if (hi > 0xff) p |= FLAG_C;
+            nz(a = (lo & 0x0f) | (hi & 0xf0));
+            return;
+        }
+        int r = a + v + c;
+        p &= ~(FLAG_V | FLAG_C);
+        if (~(a ^ v) & (a ^ r) & 0x80) p |= FLAG_V;
+        if (r > 0xff) p |= FLAG_C;
+        nz(a = r);
+    };
+    auto sbc = [&](uint8_t v) {
+        int b = ~p & FLAG_C;
+        int r = a - v - b;
+        p &= ~(FLAG_V | FLAG_C);
+        if ((a ^ v) & (a ^ r) & 0x80) p |= FLAG_V;
+        if (r >= 0) p |= FLAG_C;
+        if (p & FLAG_D) {
+            int lo = (a & 0x0f) - (v & 0x0f) - b;
+            int hi = (a & 0xf0) - (v & 0xf0);
+            if (lo < 0) { lo -= 0x06; hi -= 0x10; }
+            if (hi < 0) hi -= 0x60;
+            nz(a = (lo & 0x0f) | (hi & 0xf0));
+            return;
+        }
+        nz(a = r);
+    };
+    auto cmp = [&](uint8_t r, uint8_t v) {
+        p = (p & ~FLAG_C) | (r >= v ? FLAG_C : 0);
+        nz(r - v);
+    };
+    auto asl = [&](uint8_t v) -> uint8_t { p = (p & ~FLAG_C) | (v >> 7); return nz(v << 1); };
+    auto lsr = [&](uint8_t v) -> uint8_t { p = (p & ~FLAG_C) | (v & 1); return nz(v >> 1); };
+    auto rol = [&](uint8_t v) -> uint8_t { int c = p & FLAG_C; p = (p & ~FLAG_C) | (v >> 7); return nz(v << 1 | c); };
+    auto ror = [&](uint8_t v) -> uint8_t { int c = p & FLAG_C; p = (p & ~FLAG_C) | (v & 1); return nz(v >> 1 | c << 7); };
+    auto bit = [&](uint8_t v) {
+        p = (p & ~(FLAG_N | FLAG_V | FLAG_Z)) | (v & (FLAG_N | FLAG_V)) | ((a & v) ? 0 : FLAG_Z);
+    };
+    auto branch = [&](bool cond) {
+        int8_t d = fetch();
+        if (cond) {
+            pc += d;
+            cycles += 1;
+        }
+    };
+    auto rmw = [&](uint16_t ea, auto op) { m[ea] = op(m[ea]); };
+
+    bool ok = false;
+    while (!done && cycles < max_cycles) {
+        uint8_t op = fetch();
+        cycles += CYCLES[op];
+        switch (op) {
+        // loads and stores
+        case 0xa9: nz(a = fetch()); break;
+        case 0xa5: nz(a = m[zp()]); break;
+        case 0xb5: nz(a = m[zpx()]); break;
+        case 0xad: nz(a = m[abs()]); break;
+        case 0xbd: nz(a = m[ldx()]); break;
+        case 0xb9: nz(a = m[ldy()]); break;
+        case 0xa1: nz(a = m[indx()]); break;
+        case 0xb1: nz(a = m[ldiy()]); break;
+        case 0xa2: nz(x = fetch()); break;
+        case 0xa6: nz(x = m[zp()]); break;
+        case 0xb6: nz(x = m[zpy()]); break;
+        case 0xae: nz(x = m[abs()]); break;
+        case 0xbe: nz(x = m[ldy()]); break;
+        case 0xa0: nz(y = fetch()); break;
+        case 0xa4: nz(y = m[zp()]); break;
+        case 0xb4: nz(y = m[zpx()]); break;
+        case 0xac: nz(y = m[abs()]); break;
+        case 0xbc: nz(y = m[ldx()]); break;
+        case 0x85: m[zp()]   = a; break;
+        case 0x95: m[zpx()]  = a; break;
+        case 0x8d: m[abs()]  = a; break;
+        case 0x9d: m[absx()] = a; break;
+        case 0x99: m[absy()] = a; break;
+        case 0x81: m[indx()] = a; break;
+        case 0x91: m[indy()] = a; break;
+        case 0x86: m[zp()]   = x; break;
+        case 0x96: m[zpy()]  = x; break;
+        case 0x8e: m[abs()]  = x; break;
+        case 0x84: m[zp()]   = y; break;
+        case 0x94: m[zpx()]  = y; break;
+        case 0x8c: m[abs()]  = y; break;
+
+        // transfers and stack
+        case 0xaa: nz(x = a); break;
+        case 0xa8: nz(y = a); break;
+        case 0x8a: nz(a = x); break;
+        case 0x98: nz(a = y); break;
+        case 0xba: nz(x = sp); break;
+        case 0x9a: sp = x; break;
+        case 0x48: push(a); break;
+        case 0x08: push(p | FLAG_B | FLAG_U); break;
+        case 0x68: nz(a = pull()); break;
+        case 0x28: p = pull() | FLAG_U; break;
+
+        // arithmetic and logic
+        case 0x69: adc(fetch()); break;
+        case 0x65: adc(m[zp()]); break;
+        case 0x75: adc(m[zpx()]); break;
+        case 0x6d: adc(m[abs()]); break;
+        case 0x7d: adc(m[ldx()]); break;
+        case 0x79: adc(m[ldy()]); break;
+        case 0x61: adc(m[indx()]); break;
+        case 0x71: adc(m[ldiy()]); break;
+        case 0xe9: sbc(fetch()); break;
+        case 0xe5: sbc(m[zp()]); break;
+        case 0xf5: sbc(m[zpx()]); break;
+        case 0xed: sbc(m[abs()]); break;
+        case 0xfd: sbc(m[ldx()]); break;
+        case 0xf9: sbc(m[ldy()]); break;
+        case 0xe1: sbc(m[indx()]); break;
+        case 0xf1: sbc(m[ldiy()]); break;
+        case 0x29: nz(a &= fetch()); break;
+        case 0x25: nz(a &= m[zp()]); break;
+        case 0x35: nz(a &= m[zpx()]); break;
+        case 0x2d: nz(a &= m[abs()]); break;
+        case 0x3d: nz(a &= m[ldx()]); break;
+        case 0x39: nz(a &= m[ldy()]); break;
+        case 0x21: nz(a &= m[indx()]); break;
+        case 0x31: nz(a &= m[ldiy()]); break;
+        case 0x09: nz(a |= fetch()); break;
+        case 0x05: nz(a |= m[zp()]); break;
+        case 0x15: nz(a |= m[zpx()]); break;
+        case 0x0d: nz(a |= m[abs()]); break;
+        case 0x1d: nz(a |= m[ldx()]); break;
+        case 0x19: nz(a |= m[ldy()]); break;
+        case 0x01: nz(a |= m[indx()]); break;
+        case 0x11: nz(a |= m[ldiy()]); break;
+        case 0x49: nz(a ^= fetch()); break;
+        case 0x45: nz(a ^= m[zp()]); break;
+        case 0x55: nz(a ^= m[zpx()]); break;
+        case 0x4d: nz(a ^= m[abs()]); break;
+        case 0x5d: nz(a ^= m[ldx()]); break;
+        case 0x59: nz(a ^= m[ldy()]); break;
+        case 0x41: nz(a ^= m[indx()]); break;
+        case 0x51: nz(a ^= m[ldiy()]); break;
+        case 0xc9: cmp(a, fetch()); break;
+        case 0xc5: cmp(a, m[zp()]); break;
+        case 0xd5: cmp(a, m[zpx()]); break;
+        case 0xcd: cmp(a, m[abs()]); break;
+        case 0xdd: cmp(a, m[ldx()]); break;
+        case 0xd9: cmp(a, m[ldy()]); break;
+        case 0xc1: cmp(a, m[indx()]); break;
+        case 0xd1: cmp(a, m[ldiy()]); break;
+        case 0xe0: cmp(x, fetch()); break;
+        case 0xe4: cmp(x, m[zp()]); break;
+        case 0xec: cmp(x, m[abs()]); break;
+        case 0xc0: cmp(y, fetch()); break;
+        case 0xc4: cmp(y, m[zp()]); break;
+        case 0xcc: cmp(y, m[abs()]); break;
+        case 0x24: bit(m[zp()]); break;
+        case 0x2c: bit(m[abs()]); break;
+
+        // increments and shifts
+        case 0xe8: nz(++x); break;
+        case 0xc8: nz(++y); break;
+        case 0xca: nz(--x); break;
+        case 0x88: nz(--y); break;
+        case 0xe6: rmw(zp(),  [&](uint8_t v) { return nz(v + 1); }); break;
+        case 0xf6: rmw(zpx(), [&](uint8_t v) { return nz(v + 1); }); break;
+        case 0xee: rmw(abs(), [&](uint8_t v) { return nz(v + 1); }); break;
+        case 0xfe: rmw(absx(), [&](uint8_t v) { return nz(v + 1); }); break;
+        case 0xc6: rmw(zp(),  [&](uint8_t v) { return nz(v - 1); }); break;
+        case 0xd6: rmw(zpx(), [&](uint8_t v) { return nz(v - 1); }); break;
+        case 0xce: rmw(abs(), [&](uint8_t v) { return nz(v - 1); }); break;
+        case 0xde: rmw(absx(), [&](uint8_t v) { return nz(v - 1); }); break;
+        case 0x0a: a = asl(a); break;
+        case 0x06: rmw(zp(),  asl); break;
+        case 0x16: rmw(zpx(), asl); break;
+        case 0x0e: rmw(abs(), asl); break;
+        case 0x1e: rmw(absx(), asl); break;
+        case 0x4a: a = lsr(a); break;
+        case 0x46: rmw(zp(),  lsr); break;
+        case 0x56: rmw(zpx(), lsr); break;
+        case 0x4e: rmw(abs(), lsr); break;
+        case 0x5e: rmw(absx(), lsr); break;
+        case 0x2a: a = rol(a); break;
+        case 0x26: rmw(zp(),  rol); break;
+        case 0x36: rmw(zpx(), rol); break;
+        case 0x2e: rmw(abs(), rol); break;
+        case 0x3e: rmw(absx(), rol); break;
+        case 0x6a: a = ror(a); break;
+        case 0x66: rmw(zp(),  ror); break;
+        case 0x76: rmw(zpx(), ror); break;
+        case 0x6e: rmw(abs(), ror); break;
+        case 0x7e: rmw(absx(), ror); break;
+
+        // flags
+        case 0x18: p &= ~FLAG_C; break;
+        case 0x38: p |= FLAG_C; break;
+        case 0x58: p &= ~FLAG_I; break;
+        case 0x78: p |= FLAG_I; break;
+        case 0xd8: p &= ~FLAG_D; break;
+        case 0xf8: p |= FLAG_D; break;
+        case 0xb8: p &= ~FLAG_V; break;
+        case 0xea: break;
+
+        // control flow
+        case 0x10: branch(!(p & FLAG_N)); break;
+        case 0x30: branch(p & FLAG_N); break;
+        case 0x50: branch(!(p & FLAG_V)); break;
+        case 0x70: branch(p & FLAG_V); break;
+        case 0x90: branch(!(p & FLAG_C)); break;
+        case 0xb0: branch(p & FLAG_C); break;
+        case 0xd0: branch(!(p & FLAG_Z)); break;
+        case 0xf0: branch(p & FLAG_Z); break;
+        case 0x4c: pc = fetch2(); break;
+        case 0x6c: {
+            // the indirect vector doesn't cross pages
+            uint16_t v = fetch2();
+            pc = m[v] | m[(v & 0xff00) | uint8_t(v + 1)] << 8;
+            break;
+        }
+        case 0x20: {
+            uint16_t t = fetch2();
+            push((pc - 1) >> 8);
+            push((pc - 1) & 0xff);
+            pc = t;
+            break;
+        }
+        case 0x60: {
+            pc = pull();
+            pc |= pull() << 8;
+            ++pc;
+            if (sp == sp_top) ok = done = true;
+            break;
+        }
+        case 0x40:
+            p  = pull() | FLAG_U;
+            pc = pull();
+            pc |= pull() << 8;
+            break;
+
+        default:
+            // brk and unsupported opcodes
+            done = true;
+            break;
+        }
+    }
+
+    m_cycles += cycles;
+    m_a  = a;
+    m_x  = x;
+    m_y  = y;
+    m_sp = ok ? sp : sp_top;
+    m_p  = p;
+    return ok;
+}
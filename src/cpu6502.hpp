@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// NMOS 6502 core for running player code. Memory is a flat 64 KB array
+// without I/O, which is enough for players that only write to the sid. Only
+// the documented opcodes are supported; anything else stops the call.
+//
+// Loads through abs,X, abs,Y and (zp),Y record their base address in a
+// bitmap. That is the only trace table discovery needs, and it costs a
+// single OR per indexed load.
+class Cpu6502 {
+public:
+    Cpu6502();
+
+    void load(uint16_t addr, uint8_t const* data, size_t size);
+
+    // Calls the subroutine at addr with the given accumulator. Returns false
+    // if it doesn't return within max_cycles or runs into an unsupported
+    // opcode.
+    bool call(uint16_t addr, uint8_t a, int max_cycles);
+
+    bool indexed(uint16_t base) const { return m_trace[base >> 6] >> (base & 63) & 1; }
+    void clear_trace();
+
+    uint64_t cycles() const { return m_cycles; }
+
+    uint8_t  mem[0x10000];
+
+private:
+    uint64_t m_trace[0x10000 / 64];
+    uint64_t m_cycles = 0;
+    uint8_t  m_a      = 0;
+    uint8_t  m_x      = 0;
+    uint8_t  m_y      = 0;
+    uint8_t  m_sp     = 0xff;
+    uint8_t  m_p      = 0x24;
+};
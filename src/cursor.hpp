@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include "mapfile.hpp"
+
+// Read position in a byte span. Callers check the length of a whole section
+// or record up front with has(), then read it with the unchecked peek() and
+// next(). The position may be set anywhere, e.g. from a pointer in the data;
+// has() fails for positions outside the span.
+class Cursor {
+public:
+    Cursor() = default;
+    explicit Cursor(ByteSpan data) : m_data(data.data()), m_size(int(data.size())) {}
+
+    int  pos() const { return m_pos; }
+    void seek(int pos) { m_pos = pos; }
+    void skip(int n) { m_pos += n; }
+
+    // bytes left from the position
+    int  left() const { return m_pos >= 0 && m_pos < m_size ? m_size - m_pos : 0; }
+    bool has(int n) const { return left() >= n; }
+
+    uint8_t peek() const { return m_data[m_pos]; }
+    uint8_t next() { return m_data[m_pos++]; }
+
+private:
+    uint8_t const* m_data = nullptr;
+    int            m_size = 0;
+    int            m_pos  = 0;
+};
@@ -0,0 +1,89 @@
+#include "detectcache.hpp"
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include "bytes.hpp"
+
+
+// The file is plain text, one entry per line:
+//   <64-bit hash> <flags>
+// both in hex, after a version line. Version 1 also had a hit count per
+// entry, which made every run rewrite the file; it is read and dropped.
+static char const CACHE_VERSION[]   = "sid2sng-detect-cache 2\n";
+static char const CACHE_VERSION_1[]  = "sid2sng-detect-cache 1\n";
+
+
+uint64_t DetectCache::hash(ByteSpan player) {
+    // FNV-1a, seeded with the length
+    return fnv1a(player.data(), player.size(), FNV_BASIS ^ player.size());
+}
+
+
+bool DetectCache::load(char const* filename) {
+    FILE* file = fopen(filename, "r");
+    if (!file) return true;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    char line[128];
+    bool ok = fgets(line, sizeof(line), file) != nullptr;
+    bool v1 = ok && strcmp(line, CACHE_VERSION_1) == 0;
+    ok = ok && (v1 || strcmp(line, CACHE_VERSION) == 0);
+    while (ok && fgets(line, sizeof(line), file)) {
+        uint64_t key;
+        uint32_t flags, hits;
+        if (sscanf(line, "%" SCNx64 " %" SCNx32 " %" SCNx32, &key, &flags, &hits) != 2 + v1) {
+            ok = false;
+            break;
+        }
+        m_entries[key] = flags;
+    }
+    fclose(file);
+    if (!ok) m_entries.clear();
+    // written back in the current format
+    m_dirty = ok && v1;
+    return ok;
+}
+
+bool DetectCache::save(char const* filename) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string tmp = std::string(filename) + ".tmp";
+    FILE* file = fopen(tmp.c_str(), "w");
+    if (!file) return false;
+
+    std::string buf = CACHE_VERSION;
+    char line[64];
+    for (auto const& e : m_entries) {
+        snprintf(line, sizeof(line), "%016" PRIx64 " %02" PRIx32 "\n", e.first, e.second);
+        buf += line;
+    }
+    bool ok = fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+    ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+    // rename doesn't replace existing files on windows
+    remove(filename);
+#endif
+    ok = ok && rename(tmp.c_str(), filename) == 0;
+    if (ok) m_dirty = false;
+    return ok;
+}
+
+
+bool DetectCache::lookup(uint64_t key, uint32_t& flags) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        ++m_misses;
+        return false;
+    }
+    ++m_hits;
+    flags = it->second;
+    return true;
+}
+
+void DetectCache::insert(uint64_t key, uint32_t flags) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto r = m_entries.emplace(key, flags);
+    if (!r.second && r.first->second == flags) return;
+    r.first->second = flags;
+    m_dirty = true;
+}
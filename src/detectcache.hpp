@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "mapfile.hpp"
+
+// Persistent map from a hash of the player code to the auto-detected
+// feature flags. GoatTracker2 sids share a few player builds, so in a batch
+// most files only need the hash and a lookup instead of the signature scan.
+// Lookups and inserts may come from several threads.
+class DetectCache {
+public:
+    static uint64_t hash(ByteSpan player);
+
+    // A missing file is not an error, the cache just starts out empty.
+    bool load(char const* filename);
+    // Writes a temporary file and renames it over the old one.
+    bool save(char const* filename);
+
+    bool lookup(uint64_t key, uint32_t& flags);
+    // only a new or changed entry makes the cache dirty
+    void insert(uint64_t key, uint32_t flags);
+
+    int  hits() const { return m_hits; }
+    int  misses() const { return m_misses; }
+    bool dirty() const { return m_dirty; }
+
+private:
+    std::mutex                             m_mutex;
+    std::unordered_map<uint64_t, uint32_t> m_entries;     // flags by hash
+    int                                 m_hits   = 0;
+    int                                 m_misses = 0;
+    bool                                m_dirty  = false;
+};
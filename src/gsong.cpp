@@ -1,19 +1,105 @@
 #include "gsong.hpp"
+#include "mapfile.hpp"
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 
 
 namespace {
 
-uint8_t fread8(FILE *file) {
-    uint8_t b;
-    fread(&b, 1, 1, file);
-    return b;
+static_assert(sizeof(gt::Instr) == 9 + gt::MAX_INSTRNAMELEN, "instrument has padding");
+
+struct Reader {
+    uint8_t const* begin;
+    uint8_t const* p;
+    uint8_t const* end;
+    bool     has(size_t n) const { return size_t(end - p) >= n; }
+    uint8_t  u8() { return *p++; }
+    uint32_t offset() const { return uint32_t(p - begin); }
+    gt::ImageIndex::Section section(size_t len) {
+        gt::ImageIndex::Section s = { offset(), uint32_t(len) };
+        p += len;
+        return s;
+    }
+};
+
+bool fail(std::string* error, char const* fmt, int a = 0, int b = 0) {
+    if (error) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), fmt, a, b);
+        *error = buf;
+    }
+    return false;
 }
-void fwrite8(FILE *file, uint8_t b) {
-    fwrite(&b, 1, 1, file);
+
+// Walks a GTS5 image with the given number of channels per song. Every
+// length is checked against the remaining data and the MAX_* limits.
+bool index_sections(uint8_t const* data, size_t size, int channels, gt::ImageIndex& index, std::string* error) {
+    using namespace gt;
+    Reader r = { data, data, data + size };
+    index.channels = channels;
+
+    if (!r.has(4 + MAX_STR * 3)) return fail(error, "truncated header");
+    if (memcmp(r.p, "GTS5", 4)) return fail(error, "not a GTS5 file");
+    r.section(4);
+    index.infotexts = r.section(MAX_STR * 3);
+
+    // songorderlists
+    if (!r.has(1)) return fail(error, "truncated song count");
+    index.songs = r.u8();
+    if (index.songs > MAX_SONGS) return fail(error, "too many songs (%d)", index.songs);
+    for (int d = 0; d < index.songs; d++) {
+        for (int c = 0; c < channels; c++) {
+            if (!r.has(1)) return fail(error, "truncated order list (song %d, channel %d)", d, c);
+            int loadsize = r.u8() + 1;
+            if (!r.has(loadsize)) return fail(error, "truncated order list (song %d, channel %d)", d, c);
+            index.order[d][c] = r.section(loadsize);
+        }
+    }
+
+    // instruments
+    if (!r.has(1)) return fail(error, "truncated instrument count");
+    int amount = r.u8();
+    if (amount >= MAX_INSTR) return fail(error, "too many instruments (%d)", amount);
+    if (!r.has(amount * sizeof(Instr))) return fail(error, "truncated instruments");
+    index.instr = r.section(amount * sizeof(Instr));
+
+    // tables
+    for (int c = 0; c < MAX_TABLES; c++) {
+        if (!r.has(1)) return fail(error, "truncated table %d", c);
+        int loadsize = r.u8();
+        if (!r.has(loadsize * 2)) return fail(error, "truncated table %d", c);
+        index.table[c] = r.section(loadsize * 2);
+    }
+
+    // patterns
+    if (!r.has(1)) return fail(error, "truncated pattern count");
+    index.patterns = r.u8();
+    if (index.patterns > MAX_PATT) return fail(error, "too many patterns (%d)", index.patterns);
+    for (int c = 0; c < index.patterns; c++) {
+        if (!r.has(1)) return fail(error, "truncated pattern %d", c);
+        int rows = r.u8();
+        if (rows > MAX_PATTROWS + 1) return fail(error, "pattern %d too long (%d rows)", c, rows);
+        if (!r.has(rows * 4)) return fail(error, "truncated pattern %d", c);
+        for (int d = 0; d < rows; d++) {
+            if (r.p[d * 4 + 1] >= MAX_INSTR) return fail(error, "bad instrument in pattern %d, row %d", c, d);
+        }
+        index.pattern[c] = r.section(rows * 4);
+    }
+
+    if (r.p != r.end) return fail(error, "%d bytes of trailing data", int(r.end - r.p));
+    return true;
 }
 
+struct Writer {
+    uint8_t* p;
+    void u8(uint8_t b) { *p++ = b; }
+    void bytes(void const* data, size_t len) {
+        memcpy(p, data, len);
+        p += len;
+    }
+};
+
 } // namespace
 
 
@@ -94,73 +180,90 @@ void gt::Song::clear() {
     count_pattern_lengths();
 }
 
+void gt::Song::reset(int patterns) {
+    channels = 3;
+    for (int c = 0; c < MAX_CHN; c++) {
+        for (int d = 0; d < MAX_SONGS; d++) {
+            // the list, its end mark and the restart position
+            uint8_t* order = songorder[d][c];
+            int      len   = 0;
+            while (len < MAX_SONGLEN && order[len] < LOOPSONG) len++;
+            memset(order, 0, std::min(len + 2, MAX_SONGLEN + 2));
+            if (!d) {
+                order[0] = c;
+                order[1] = LOOPSONG;
+            }
+            else {
+                order[0] = LOOPSONG;
+            }
+        }
+    }
+    memset(songname, 0, sizeof songname);
+    memset(authorname, 0, sizeof authorname);
+    memset(copyrightname, 0, sizeof copyrightname);
+    for (int c = 0; c < patterns; c++) clear_pattern(c);
+    // small enough to clear completely
+    for (int c = 0; c < MAX_INSTR; c++) clear_instr(c);
+    memset(ltable, 0, sizeof ltable);
+    memset(rtable, 0, sizeof rtable);
+    count_pattern_lengths();
+}
+
 
-bool gt::Song::load(char const* filename) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) return false;
-    char ident[4];
-    fread(ident, 4, 1, file);
-    if (memcmp(ident, "GTS5", 4)) {
-        fclose(file);
-        return false;
+bool gt::index_image(uint8_t const* data, size_t size, ImageIndex& index, std::string* error) {
+    // The channel count isn't stored. The section lengths only add up to the
+    // image size for the right one, so try them all.
+    std::string first_error;
+    for (int chn : { 3, 6, 9 }) {
+        std::string e;
+        if (index_sections(data, size, chn, index, &e)) return true;
+        if (first_error.empty()) first_error = e;
     }
+    if (error) *error = first_error;
+    return false;
+}
 
-    clear();
 
-    // read infotexts
-    fread(songname, 1, sizeof(songname), file);
-    fread(authorname, 1, sizeof(authorname), file);
-    fread(copyrightname, 1, sizeof(copyrightname), file);
+bool gt::Song::load(char const* filename, std::string* error) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        if (error) *error = "could not open file";
+        return false;
+    }
+    return load(file.span().data(), file.span().size(), error);
+}
+
+bool gt::Song::load(uint8_t const* data, size_t size, std::string* error) {
+    ImageIndex index;
+    if (!index_image(data, size, index, error)) return false;
 
-    // read songorderlists
-    int amount = fread8(file);
-    for (int d = 0; d < amount; d++) {
-        for (int c = 0; c < MAX_CHN; c++) {
-            int loadsize = fread8(file) + 1;
-            fread(songorder[d][c], loadsize, 1, file);
+    clear();
+    channels = index.channels;
+    memcpy(songname, data + index.infotexts.offset, MAX_STR);
+    memcpy(authorname, data + index.infotexts.offset + MAX_STR, MAX_STR);
+    memcpy(copyrightname, data + index.infotexts.offset + MAX_STR * 2, MAX_STR);
+    for (int d = 0; d < index.songs; d++) {
+        for (int c = 0; c < channels; c++) {
+            memcpy(songorder[d][c], data + index.order[d][c].offset, index.order[d][c].size);
         }
     }
-    // read instruments
-    amount = fread8(file);
-    for (int c = 1; c <= amount; c++) {
-        instr[c].ad        = fread8(file);
-        instr[c].sr        = fread8(file);
-        instr[c].ptr[WTBL] = fread8(file);
-        instr[c].ptr[PTBL] = fread8(file);
-        instr[c].ptr[FTBL] = fread8(file);
-        instr[c].ptr[STBL] = fread8(file);
-        instr[c].vibdelay  = fread8(file);
-        instr[c].gatetimer = fread8(file);
-        instr[c].firstwave = fread8(file);
-        fread(&instr[c].name, MAX_INSTRNAMELEN, 1, file);
-    }
-    // read tables
+    memcpy(&instr[1], data + index.instr.offset, index.instr.size);
     for (int c = 0; c < MAX_TABLES; c++) {
-        int loadsize = fread8(file);
-        fread(ltable[c], loadsize, 1, file);
-        fread(rtable[c], loadsize, 1, file);
+        int len = index.table[c].size / 2;
+        memcpy(ltable[c], data + index.table[c].offset, len);
+        memcpy(rtable[c], data + index.table[c].offset + len, len);
     }
-    // read patterns
-    amount = fread8(file);
-    for (int c = 0; c < amount; c++) {
-        int length = fread8(file) * 4;
-        fread(pattern[c], length, 1, file);
+    for (int c = 0; c < index.patterns; c++) {
+        memcpy(pattern[c], data + index.pattern[c].offset, index.pattern[c].size);
     }
-    fclose(file);
-
     count_pattern_lengths();
-
     return true;
 }
 
 
-bool gt::Song::save(char const* filename) {
+void gt::Song::save(std::vector<uint8_t>& image) {
     count_pattern_lengths();
 
-    FILE* file = fopen(filename, "wb");
-    if (!file) return false;
-    fwrite("GTS5", 1, 4, file);
-
     //for (int c = 1; c < MAX_INSTR; c++) {
     //    if (instr[c].ad || instr[c].sr || instr[c].ptr[0] || instr[c].ptr[1] ||
     //        instr[c].ptr[2] || instr[c].vibdelay || instr[c].ptr[3])
@@ -169,59 +272,85 @@ bool gt::Song::save(char const* filename) {
     //    }
     //}
 
+    int songs = MAX_SONGS - 1;
+    for (;;) {
+        if (songlen[songs][0] && songlen[songs][1] && songlen[songs][2]) break;
+        if (songs == 0) break;
+        --songs;
+    }
+    ++songs;
+    int tablelen[MAX_TABLES];
+    for (int c = 0; c < MAX_TABLES; c++) tablelen[c] = gettablelen(c);
+    int patterns = highestusedpattern + 1;
+
+    // precompute the size so the image is written in one go
+    size_t size = 4 + sizeof(songname) + sizeof(authorname) + sizeof(copyrightname);
+    size += 1;
+    for (int d = 0; d < songs; d++) {
+        for (int c = 0; c < channels; c++) size += 1 + uint8_t(songlen[d][c] + 1) + 1;
+    }
+    size += 1 + highestusedinstr * (9 + MAX_INSTRNAMELEN);
+    for (int c = 0; c < MAX_TABLES; c++) size += 1 + tablelen[c] * 2;
+    size += 1;
+    for (int c = 0; c < patterns; c++) size += 1 + uint8_t(pattlen[c] + 1) * 4;
+
+    image.resize(size);
+    Writer w = { image.data() };
+    w.bytes("GTS5", 4);
+
     // infotexts
-    fwrite(songname, 1, sizeof(songname), file);
-    fwrite(authorname, 1, sizeof(authorname), file);
-    fwrite(copyrightname, 1, sizeof(copyrightname), file);
+    w.bytes(songname, sizeof(songname));
+    w.bytes(authorname, sizeof(authorname));
+    w.bytes(copyrightname, sizeof(copyrightname));
 
     // songorderlists
-    int c = MAX_SONGS - 1;
-    for (;;) {
-        if (songlen[c][0] && songlen[c][1] && songlen[c][2]) break;
-        if (c == 0) break;
-        --c;
-    }
-    int amount = c + 1;
-    fwrite8(file, amount);
-    for (int d = 0; d < amount; d++) {
+    w.u8(songs);
+    for (int d = 0; d < songs; d++) {
         for (int c = 0; c < channels; c++) {
-            int length = songlen[d][c] + 1;
-            fwrite8(file, length);
-            int writebytes = length + 1;
-            fwrite(songorder[d][c], 1, writebytes, file);
+            uint8_t length = songlen[d][c] + 1;
+            w.u8(length);
+            w.bytes(songorder[d][c], length + 1);
         }
     }
     // instruments
-    fwrite8(file, highestusedinstr);
+    w.u8(highestusedinstr);
     for (int c = 1; c <= highestusedinstr; c++) {
-        fwrite8(file, instr[c].ad);
-        fwrite8(file, instr[c].sr);
-        fwrite8(file, instr[c].ptr[WTBL]);
-        fwrite8(file, instr[c].ptr[PTBL]);
-        fwrite8(file, instr[c].ptr[FTBL]);
-        fwrite8(file, instr[c].ptr[STBL]);
-        fwrite8(file, instr[c].vibdelay);
-        fwrite8(file, instr[c].gatetimer);
-        fwrite8(file, instr[c].firstwave);
-        fwrite(&instr[c].name, 1, MAX_INSTRNAMELEN, file);
-    }
-    // Write tables
+        w.u8(instr[c].ad);
+        w.u8(instr[c].sr);
+        w.u8(instr[c].ptr[WTBL]);
+        w.u8(instr[c].ptr[PTBL]);
+        w.u8(instr[c].ptr[FTBL]);
+        w.u8(instr[c].ptr[STBL]);
+        w.u8(instr[c].vibdelay);
+        w.u8(instr[c].gatetimer);
+        w.u8(instr[c].firstwave);
+        w.bytes(instr[c].name, MAX_INSTRNAMELEN);
+    }
+    // tables
     for (int c = 0; c < MAX_TABLES; c++) {
-        int writebytes = gettablelen(c);
-        fwrite8(file, writebytes);
-        fwrite(ltable[c], 1, writebytes, file);
-        fwrite(rtable[c], 1, writebytes, file);
+        w.u8(tablelen[c]);
+        w.bytes(ltable[c], tablelen[c]);
+        w.bytes(rtable[c], tablelen[c]);
     }
-    // Write patterns
-    amount = highestusedpattern + 1;
-    fwrite8(file, amount);
-    for (int c = 0; c < amount; c++) {
-        int length = pattlen[c] + 1;
-        fwrite8(file, length);
-        fwrite(pattern[c], 1, length * 4, file);
+    // patterns
+    w.u8(patterns);
+    for (int c = 0; c < patterns; c++) {
+        uint8_t length = pattlen[c] + 1;
+        w.u8(length);
+        w.bytes(pattern[c], length * 4);
     }
-    fclose(file);
+}
 
-    return true;
+
+bool gt::Song::save(FILE* file) {
+    std::vector<uint8_t> image;
+    save(image);
+    return fwrite(image.data(), 1, image.size(), file) == image.size();
 }
 
+bool gt::Song::save(char const* filename) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) return false;
+    bool ok = save(file);
+    return fclose(file) == 0 && ok;
+}
@@ -1,5 +1,8 @@
 #pragma once
 #include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
 
 namespace gt {
 
@@ -91,10 +94,21 @@ struct Song {
     int     highestusedinstr;
 
     void count_pattern_lengths();
-    bool load(char const* filename);
+    // Load a GTS5 image. On failure, error describes what's wrong and the
+    // song is left untouched.
+    bool load(char const* filename, std::string* error = nullptr);
+    bool load(uint8_t const* data, size_t size, std::string* error = nullptr);
     bool save(char const* filename);
+    bool save(FILE* file);
+
+    // build the GTS5 image in memory, reusing the capacity of image
+    void save(std::vector<uint8_t>& image);
 
     void clear();
+    // Same as clear() for a cleared song that was only written to in its
+    // first patterns and in its order lists up to their end marks and
+    // restart positions, as the converter does. The rest is left alone.
+    void reset(int patterns);
     void clear_pattern(int p);
     void clear_instr(int num);
 
@@ -108,4 +122,24 @@ struct Song {
 };
 
 
+// Location of the sections of a GTS5 image.
+struct ImageIndex {
+    struct Section {
+        uint32_t offset;
+        uint32_t size;
+    };
+    int     channels;
+    int     songs;
+    int     patterns;
+    Section infotexts;
+    Section order[MAX_SONGS][MAX_CHN];
+    Section instr;
+    Section table[MAX_TABLES];  // ltable followed by rtable
+    Section pattern[MAX_PATT];
+};
+
+// Validate a GTS5 image and find its sections.
+bool index_image(uint8_t const* data, size_t size, ImageIndex& index, std::string* error = nullptr);
+
+
 } // namespace gt
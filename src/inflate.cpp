@@ -0,0 +1,285 @@
+#include "inflate.hpp"
+#include <array>
+#include <cstring>
+
+
+namespace {
+
+enum {
+    MAX_BITS    = 15,
+    FAST_BITS   = 10,     // codes up to this long are decoded with one lookup
+    LITLEN_SYMS = 288,
+    DIST_SYMS   = 32,
+    END_BLOCK   = 256,
+};
+
+constexpr uint16_t LEN_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+constexpr uint8_t LEN_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+constexpr uint16_t DIST_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+constexpr uint8_t DIST_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+// order of the code length code lengths
+constexpr uint8_t CLEN_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+
+// LSB first bit reader. Past the end it reads zeros and counts them, so
+// the decoder needs no bounds checks and looks at the count once per block.
+class BitReader {
+public:
+    explicit BitReader(ByteSpan in) : m_p(in.begin()), m_end(in.end()) {}
+
+    void refill() {
+        while (m_count <= 56) {
+            uint64_t b = m_p < m_end ? *m_p++ : (++m_padding, 0);
+            m_buf   |= b << m_count;
+            m_count += 8;
+        }
+    }
+    uint32_t peek() const { return uint32_t(m_buf); }
+    void consume(int n) {
+        m_buf  >>= n;
+        m_count -= n;
+    }
+    uint32_t bits(int n) {
+        if (m_count < n) refill();
+        uint32_t x = uint32_t(m_buf) & ((1u << n) - 1);
+        consume(n);
+        return x;
+    }
+    void align() { consume(m_count % 8); }
+
+    // copies whole bytes after align()
+    bool copy(uint8_t* out, size_t n) {
+        for (; n > 0 && m_count >= 8; --n) *out++ = uint8_t(bits(8));
+        if (overrun() || size_t(m_end - m_p) < n) return false;
+        if (n) memcpy(out, m_p, n);
+        m_p += n;
+        return true;
+    }
+
+    bool overrun() const { return m_padding * 8 > m_count; }
+
+private:
+    uint8_t const* m_p;
+    uint8_t const* m_end;
+    uint64_t       m_buf     = 0;
+    int            m_count   = 0;
+    int            m_padding = 0;   // zero bytes read past the end
+};
+
+
+// Canonical Huffman code. Short codes are looked up in fast, which is
+// indexed by the next FAST_BITS input bits and holds symbol << 4 | length.
+// Longer codes are decoded by walking the code lengths.
+struct Huffman {
+    uint16_t fast[1 << FAST_BITS];
+    uint16_t count[MAX_BITS + 1];
+    uint16_t symbol[LITLEN_SYMS];
+
+    // incomplete codes are fine, the missing codes fail in decode()
+    bool build(uint8_t const* lengths, int n) {
+        memset(count, 0, sizeof(count));
+        for (int i = 0; i < n; ++i) ++count[lengths[i]];
+        count[0] = 0;
+        int left = 1;
+        for (int len = 1; len <= MAX_BITS; ++len) {
+            left = left * 2 - count[len];
+            if (left < 0) return false;
+        }
+
+        uint16_t offset[MAX_BITS + 2] = {};
+        for (int len = 1; len <= MAX_BITS; ++len) offset[len + 1] = offset[len] + count[len];
+        for (int i = 0; i < n; ++i) {
+            if (lengths[i]) symbol[offset[lengths[i]]++] = i;
+        }
+
+        memset(fast, 0, sizeof(fast));
+        int code = 0, index = 0;
+        for (int len = 1; len <= FAST_BITS; ++len) {
+            for (int i = 0; i < count[len]; ++i, ++code, ++index) {
+                // the code is sent MSB first
+                int rev = 0;
+                for (int b = 0; b < len; ++b) rev |= (code >> b & 1) << (len - 1 - b);
+                for (int j = rev; j < (1 << FAST_BITS); j += 1 << len) {
+                    fast[j] = uint16_t(symbol[index] << 4 | len);
+                }
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+
+    // needs MAX_BITS bits in the reader; -1 for unused codes
+    int decode(BitReader& in) const {
+        uint32_t bits = in.peek();
+        int      e    = fast[bits & ((1 << FAST_BITS) - 1)];
+        if (e) {
+            in.consume(e & 15);
+            return e >> 4;
+        }
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len <= MAX_BITS; ++len) {
+            code |= bits >> (len - 1) & 1;
+            int n = count[len];
+            if (unsigned(code - first) < unsigned(n)) {
+                in.consume(len);
+                return symbol[index + code - first];
+            }
+            index += n;
+            first  = (first + n) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+};
+
+struct FixedCodes {
+    Huffman litlen;
+    Huffman dist;
+
+    FixedCodes() {
+        uint8_t lengths[LITLEN_SYMS];
+        memset(lengths, 8, 144);
+        memset(lengths + 144, 9, 112);
+        memset(lengths + 256, 7, 24);
+        memset(lengths + 280, 8, 8);
+        litlen.build(lengths, LITLEN_SYMS);
+        memset(lengths, 5, DIST_SYMS);
+        dist.build(lengths, DIST_SYMS);
+    }
+};
+
+
+bool read_dynamic(BitReader& in, Huffman& litlen, Huffman& dist) {
+    in.refill();
+    int nlen  = in.bits(5) + 257;
+    int ndist = in.bits(5) + 1;
+    int nclen = in.bits(4) + 4;
+    if (nlen > 286 || ndist > 30) return false;
+
+    uint8_t lengths[LITLEN_SYMS + DIST_SYMS] = {};
+    for (int i = 0; i < nclen; ++i) lengths[CLEN_ORDER[i]] = uint8_t(in.bits(3));
+    Huffman clen;
+    if (!clen.build(lengths, 19)) return false;
+
+    int n = 0;
+    while (n < nlen + ndist) {
+        in.refill();
+        int sym = clen.decode(in);
+        if (sym < 0) return false;
+        if (sym < 16) {
+            lengths[n++] = uint8_t(sym);
+            continue;
+        }
+        int     repeat = 0;
+        uint8_t len    = 0;
+        if (sym == 16) {
+            if (n == 0) return false;
+            len    = lengths[n - 1];
+            repeat = 3 + in.bits(2);
+        }
+        else if (sym == 17) {
+            repeat = 3 + in.bits(3);
+        }
+        else {
+            repeat = 11 + in.bits(7);
+        }
+        if (n + repeat > nlen + ndist) return false;
+        memset(lengths + n, len, repeat);
+        n += repeat;
+    }
+    // a block without an end code can't be right
+    if (lengths[END_BLOCK] == 0) return false;
+    return litlen.build(lengths, nlen) && dist.build(lengths + nlen, ndist) && !in.overrun();
+}
+
+} // namespace
+
+
+bool inflate(ByteSpan data, uint8_t* out, size_t size) {
+    static FixedCodes const fixed;
+    Huffman   dyn_litlen, dyn_dist;
+    BitReader in(data);
+    size_t    pos = 0;
+    bool      last;
+    do {
+        in.refill();
+        last     = in.bits(1);
+        int type = in.bits(2);
+        if (type == 0) {
+            in.align();
+            uint32_t len  = in.bits(16);
+            uint32_t nlen = in.bits(16);
+            if ((len ^ 0xffff) != nlen || len > size - pos) return false;
+            if (!in.copy(out + pos, len)) return false;
+            pos += len;
+            continue;
+        }
+        if (type == 3) return false;
+        if (type == 2 && !read_dynamic(in, dyn_litlen, dyn_dist)) return false;
+        Huffman const& litlen = type == 1 ? fixed.litlen : dyn_litlen;
+        Huffman const& dist   = type == 1 ? fixed.dist : dyn_dist;
+
+        for (;;) {
+            // enough bits for a length and a distance with their extra bits
+            in.refill();
+            int sym = litlen.decode(in);
+            if (sym < END_BLOCK) {
+                if (sym < 0 || pos == size) return false;
+                out[pos++] = uint8_t(sym);
+                continue;
+            }
+            if (sym == END_BLOCK) break;
+            sym -= END_BLOCK + 1;
+            if (sym >= 29) return false;
+            size_t len = LEN_BASE[sym] + in.bits(LEN_EXTRA[sym]);
+            int    d   = dist.decode(in);
+            if (d < 0 || d >= 30) return false;
+            size_t distance = DIST_BASE[d] + in.bits(DIST_EXTRA[d]);
+            if (distance > pos || len > size - pos) return false;
+            uint8_t*       dst = out + pos;
+            uint8_t const* src = dst - distance;
+            if (distance >= len) memcpy(dst, src, len);
+            else for (size_t i = 0; i < len; ++i) dst[i] = src[i];
+            pos += len;
+        }
+        if (in.overrun()) return false;
+    } while (!last);
+    return pos == size && !in.overrun();
+}
+
+
+namespace {
+
+constexpr std::array<uint32_t, 256> make_crc_table() {
+    std::array<uint32_t, 256> table = {};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320 ^ c >> 1 : c >> 1;
+        table[i] = c;
+    }
+    return table;
+}
+
+constexpr std::array<uint32_t, 256> CRC_TABLE = make_crc_table();
+
+} // namespace
+
+uint32_t crc32(ByteSpan data) {
+    uint32_t c = 0xffffffff;
+    for (uint8_t b : data) c = CRC_TABLE[(c ^ b) & 0xff] ^ c >> 8;
+    return c ^ 0xffffffff;
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "mapfile.hpp"
+
+// Decodes a raw DEFLATE stream (RFC 1951) into out, which must be exactly
+// as big as the decoded data, as zip files record it. Returns false for
+// damaged streams, streams that end early and sizes that don't match.
+bool inflate(ByteSpan in, uint8_t* out, size_t size);
+
+// CRC-32 as used by zip and gzip
+uint32_t crc32(ByteSpan data);
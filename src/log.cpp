@@ -0,0 +1,29 @@
+#include "log.hpp"
+#include <cstdio>
+
+
+void Log::print(LogLevel level, char const* fmt, ...) {
+    if (!enabled(level)) return;
+    va_list args;
+    va_start(args, fmt);
+    vprint(level, fmt, args);
+    va_end(args);
+}
+
+void Log::vprint(LogLevel level, char const* fmt, va_list args) {
+    if (!enabled(level)) return;
+
+    // format straight into the buffer, most lines fit into the first try
+    enum { GUESS = 128 };
+    va_list copy;
+    va_copy(copy, args);
+    size_t pos = m_buffer.size();
+    m_buffer.resize(pos + GUESS);
+    int n = vsnprintf(&m_buffer[pos], GUESS, fmt, args);
+    if (n >= GUESS) {
+        m_buffer.resize(pos + n + 1);
+        vsnprintf(&m_buffer[pos], n + 1, fmt, copy);
+    }
+    va_end(copy);
+    m_buffer.resize(pos + (n > 0 ? n : 0));
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdarg>
+#include <string>
+
+enum LogLevel {
+    LOG_ERROR,      // errors and warnings only (-q)
+    LOG_SUMMARY,    // sid header and detected options
+    LOG_VERBOSE,    // full dump of the decoded song (-v)
+};
+
+// Per-conversion output buffer. Messages above the log level are dropped
+// before formatting; callers guard whole dumps with enabled(). The buffer is
+// handed out whole, so the output of parallel conversions can be written
+// without interleaving.
+class Log {
+public:
+    explicit Log(LogLevel level = LOG_SUMMARY) : m_level(level) {}
+
+    LogLevel level() const { return m_level; }
+    bool     enabled(LogLevel level) const { return level <= m_level; }
+
+    void print(LogLevel level, char const* fmt, ...);
+    void vprint(LogLevel level, char const* fmt, va_list args);
+
+    std::string const& buffer() const { return m_buffer; }
+    void clear() { m_buffer.clear(); }
+    // adds text that was already filtered at this level
+    void append(std::string const& text) { m_buffer += text; }
+    void swap(std::string& s) { s.swap(m_buffer); }
+
+private:
+    LogLevel    m_level;
+    std::string m_buffer;
+};
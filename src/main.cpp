@@ -1,566 +1,560 @@
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
 #include <vector>
 #include <algorithm>
-#include <regex>
-#include "gsong.hpp"
-
-
-#ifdef _MSC_VER
-uint16_t swap(uint16_t v) { return  _byteswap_ushort(v); }
-uint32_t swap(uint32_t v) { return  _byteswap_ulong(v); }
-#else
-uint16_t swap(uint16_t v) { return  __builtin_bswap16(v); }
-uint32_t swap(uint32_t v) { return  __builtin_bswap32(v); }
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
 #endif
-
-
-#pragma pack(push, 1)
-struct SidHeader {
-    uint8_t  magic[4];
-    uint16_t version;
-    uint16_t offset;
-    uint16_t load_addr;
-    uint16_t init_addr;
-    uint16_t play_addr;
-    uint16_t song_count;
-    uint16_t start_song;
-    uint32_t speed;
-    char     song_name[32];
-    char     song_author[32];
-    char     song_released[32];
-    uint16_t flags;
-    uint8_t  start_page;
-    uint8_t  page_length;
-    uint8_t  sid_addr_2;
-    uint8_t  sid_addr_3;
-};
-#pragma pack(pop)
-
-
-class Sid2Song {
-public:
-
-    bool run();
-
-    const char* m_sid_filename = nullptr;
-    const char* m_sng_filename = "out.sng";
-    bool        m_nopulse      = false;
-    bool        m_nofilter     = false;
-    bool        m_noinstrvib   = false;
-    bool        m_fixedparams  = false;
-    bool        m_nowavedelay  = false;
-    bool        m_autodetect   = true;
-
-private:
-
-    bool load_sid();
-    bool re_search(const std::string& re);
-    void autodetect_options();
-
-    uint8_t peek() {
-        if (m_pos >= (int) m_data.size()) {
-            printf("ERROR: peek\n");
-            exit(1);
-        }
-        return m_data[m_pos];
-    }
-    uint8_t read() {
-        if (m_pos >= (int) m_data.size()) {
-            printf("ERROR: read\n");
-            exit(1);
-        }
-        return m_data[m_pos++];
-    }
-
-    gt::Song             m_song = {};
-    std::vector<uint8_t> m_data;
-    int                  m_pos;
-    int                  m_song_count;
-    int                  m_addr_offset;
-};
-
-
-bool Sid2Song::load_sid() {
-    std::ifstream ifs(m_sid_filename, std::ios::binary | std::ios::ate);
-    if (!ifs.is_open()) {
-        printf("ERROR: could not open file\n");
-        return false;
-    }
-    m_data.resize(ifs.tellg());
-    ifs.seekg(0, std::ios::beg);
-    ifs.read((char*) m_data.data(), m_data.size());
-
-
-    SidHeader& h = *(SidHeader*) m_data.data();
-    h.version    = swap(h.version);
-    h.offset     = swap(h.offset);
-    h.load_addr  = swap(h.load_addr);
-    h.init_addr  = swap(h.init_addr);
-    h.play_addr  = swap(h.play_addr);
-    h.song_count = swap(h.song_count);
-    h.start_song = swap(h.start_song);
-    h.speed      = swap(h.speed);
-
-    // ???
-    h.load_addr = m_data[h.offset] | (m_data[h.offset + 1] << 8);
-
-    printf("SID\n");
-    printf(" magic:       %.4s\n", h.magic);
-    printf(" version:     %d\n", h.version);
-    printf(" offset:      %04X\n", h.offset);
-    printf(" load addr:   %04X\n", h.load_addr);
-    printf(" init addr:   %04X\n", h.init_addr);
-    printf(" play addr:   %04X\n", h.play_addr);
-    printf(" song count:  %d\n", h.song_count);
-    printf(" start song:  %d\n", h.start_song);
-    printf(" speed:       %08X\n", h.speed);
-    printf(" song name:   %.32s\n", h.song_name);
-    printf(" song author: %.32s\n", h.song_author);
-    printf(" copyright:   %.32s\n", h.song_released);
-    if (h.version > 1) {
-        h.flags = swap(h.flags);
-        printf(" flags:       %04X\n", h.flags);
-        printf(" start page:  %02X\n", h.start_page);
-        printf(" page length: %02X\n", h.page_length);
-        printf(" sid 2 addr:  %02X\n", h.sid_addr_2);
-        printf(" sid 3 addr:  %02X\n", h.sid_addr_3);
-    }
-
-    m_song.clear();
-    memcpy(m_song.songname, h.song_name, sizeof(h.song_name));
-    memcpy(m_song.authorname, h.song_author, sizeof(h.song_author));
-    memcpy(m_song.copyrightname, h.song_released, sizeof(h.song_released));
-
-    m_song_count  = h.song_count;
-    m_addr_offset = h.offset - h.load_addr + 2;
-
-    bool is_2sid = ((h.version >= 3) && (h.sid_addr_2 != 0x00));
-    bool is_3sid = ((h.version >= 4) && (h.sid_addr_2 != 0x00) && (h.sid_addr_3 != 0x00));
-    m_song.channels = (is_3sid ? 9 : (is_2sid ? 6 : 3));
-
-    return true;
+#include "archive.hpp"
+#include "bytes.hpp"
+#include "convertcache.hpp"
+#include "detectcache.hpp"
+#include "report.hpp"
+#include "sid2sng.hpp"
+#include "sidindex.hpp"
+#include "songpack.hpp"
+#include "threadpool.hpp"
+#include "watch.hpp"
+
+
+namespace fs = std::filesystem;
+
+bool is_sid_file(fs::directory_entry const& entry, std::error_code& ec) {
+    if (!entry.is_regular_file(ec)) return false;
+    std::string ext = entry.path().extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".sid";
 }
 
-
-bool Sid2Song::re_search(const std::string& re) {
-    std::string data(m_data.begin(), m_data.end());
-
-    // In ECMAScript, the dot (.) matches any character except line
-    // terminators (LF, CR, LS, PS). So first replace all dots by an
-    // expression that matches any character including line terminators.
-    std::string ppre;
-    ppre = std::regex_replace(re, std::regex(R"(\.)"), R"([\d\D])");
-    std::regex regex(ppre, std::regex_constants::ECMAScript | std::regex_constants::nosubs);
-
-    return std::regex_search(data, regex);
+// modification time as stored in the index
+int64_t mtime(fs::directory_entry const& entry, std::error_code& ec) {
+    return entry.last_write_time(ec).time_since_epoch().count();
 }
 
-void Sid2Song::autodetect_options() {
-    // Auto-detecting disabled player features works by searching for unique
-    // code snippets. Only instruction opcodes and const immediate values are
-    // used in the comparison. The dots (.) in the regular expressions are
-    // later converted to match any character including line terminators.
-    // The code snippets have been veried for player versions 2.63 and 2.73.
 
-    // v2.73 or similar
-    // mt_skipwave2:
-    // .C:11d8  FE B1 13    INC $13B1,X	    alt: lda #$ff; sta addr,x
-    // mt_skipwave:
-    // .C:11db  B9 01 15    LDA $1501,Y     /- .IF (NOPULSE == 0)
-    // .C:11de  F0 08       BEQ $11E8       |
-    // .C:11e0  9D 9B 13    STA $139B,X     |
-    //                                      |   /- .IF (NOPULSEMOD == 0)
-    //                                      |   \-
-    // mt_skippulse:                        \-
-    //
-    // v2.63 or similar
-    // .C:0a46  9D CF 0C    STA $0CCF,X     alt: sta zp,x
-    // .C:0a49  B9 41 0F    LDA $0F41,Y     /- .IF (NOPULSE == 0)
-    // .C:0a4c  F0 08       BEQ $0A56       |
-    // .C:0a4e  9D 94 0C    STA $0C94,X     |
-    m_nopulse = not re_search(R"((\x95.|\x9d..|\xfe..)\xb9..\xf0.\x9d)");
-    printf("auto-detect nopulse = %d\n", m_nopulse);
+// Scratch space of a batch worker, kept from one file to the next.
+struct BatchScratch {
+    explicit BatchScratch(sid2sng::Options const& options) : conv(options) {}
 
-    // mt_filtstep:
-    // .C:1101  A0 00       LDY #$00        /- .IF (NOFILTER == 0)
-    // .C:1103  F0 45       BEQ $114A       |
-    // mt_filttime:                         |
-    // .C:1105  A9 00       LDA #$00	    |   /- .IF (NOFILTERMOD == 0)
-    // .C:1107  D0 23       BNE $112C	    |   \-
-    // mt_newfiltstep:                      |
-    // .C:1109  B9 FB 15    LDA $15FB,Y     |
-    // .C:110c  F0 12       BEQ $1120       \-
-    m_nofilter = not re_search(R"(\xa0.\xf0.(\xa9.\xd0.)?\xb9..\xf0)");
-    printf("auto-detect nofilter = %d\n", m_nofilter);
-
-    // mt_effect_0_delay:                   /- .IF (NOINSTRVIB == 0)
-    // .C:1044  DE C1 13    DEC $13C1,X     |
-    // mt_effect_0_donothing:               |
-    // .C:1047  4C 7D 12    JMP $127D       |
-    // mt_effect_0:                         |
-    // .C:104a  F0 FB       BEQ $1047       |
-    // .C:104c  BD C1 13    LDA $13C1,X     |
-    // .C:104f  D0 F3       BNE $1044       \-
-    m_noinstrvib = not re_search(R"(\xde..\x4c..\xf0.\xbd..\xd0)");
-    printf("auto-detect noinstrvib = %d\n", m_noinstrvib);
-
-    // mt_nonewpatt:
-    // .C:11aa  BC B0 13    LDY $13B0,X
-    //          B9 .. ..    lda addr,y      /- (FIXEDPARAMS == 0)
-    //          9D .. ..    sta addr,x      \-
-    // .C:11ad  BD 98 13    LDA $1398,X
-    // .C:11b0  F0 5E       BEQ $1210
-    // mt_newnoteinit:
-    // .C:11b2  38          SEC
-    // .C:11b3  E9 60       SBC #$60
-    m_fixedparams = not re_search(R"(\xbc..\xb9..\x9d..\xbd..\xf0.\x38\xe9)");
-    printf("auto-detect fixedparams = %d\n", m_fixedparams);
+    std::vector<uint8_t> sid;
+    sid2sng::Converter   conv;
+};
 
-    // mt_waveexec:
-    // ...
-    // .C:121e  C9 10       CMP #$10	    /- .IF (NOWAVEDELAY == 0)
-    // .C:1220  B0 0A       BCS $122C       |
-    // .C:1222  DD C2 13    CMP $13C2,X     |
-    // .C:1225  F0 0A       BEQ $1231       |
-    m_nowavedelay = not re_search(R"(\xc9\x10\xb0.\xdd..\xf0)");
-    printf("auto-detect nowavedelay = %d\n", m_nowavedelay);
+std::vector<BatchScratch> make_scratch(sid2sng::Options const& options, int threads) {
+    std::vector<BatchScratch> scratch;
+    scratch.reserve(threads);
+    for (int i = 0; i < threads; ++i) scratch.emplace_back(options);
+    return scratch;
 }
 
-
-uint8_t const* find_mem(uint8_t const* haystack, int haystack_len, uint8_t const* needle, int needle_len) {
-    for (uint8_t const* h = haystack; haystack_len >= needle_len; ++h, --haystack_len) {
-        if (memcmp(h, needle, needle_len) == 0) return h;
+// Converts a sid in memory and writes the song to the file sng, or appends
+// it to pack under that name. Write errors are added to the result.
+sid2sng::Result convert_to(ByteSpan sid, std::string const& sid_path, std::string const& sng,
+                           BatchScratch& s, PackWriter* pack) {
+    sid2sng::Result res = s.conv.convert(sid);
+    if (pack) {
+        pack->add(sid_path, sng, SidIndex::hash(sid), res, s.conv.sng());
+        return res;
     }
-    return nullptr;
+    if (!res.ok()) return res;
+    ByteSpan song = s.conv.sng();
+    FILE* file = fopen(sng.c_str(), "wb");
+    bool  ok   = file && fwrite(song.data(), 1, song.size(), file) == song.size();
+    if (file) ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        res.error = sid2sng::ERR_WRITE;
+        res.log  += "ERROR: could not write " + sng + "\n";
+    }
+    return res;
 }
 
-
-bool Sid2Song::run() {
-
-    if (!load_sid()) return false;
-
-    // find end of freq table
-    uint8_t const FREQ_HI[] = "\x08\x09\x09\x0a\x0a\x0b\x0c\x0d\x0d\x0e\x0f\x10\x11\x12\x13\x14"
-                              "\x15\x17\x18\x1a\x1b\x1d\x1f\x20\x22\x24\x27\x29\x2b\x2e\x31\x34"
-                              "\x37\x3a\x3e\x41\x45\x49\x4e\x52\x57\x5c\x62\x68\x6e\x75\x7c\x83"
-                              "\x8b\x93\x9c\xa5\xaf\xb9\xc4\xd0\xdd\xea\xf8\xff";
-    uint8_t const* hi = find_mem(m_data.data(), m_data.size(), FREQ_HI, 12);
-    if (!hi) {
-        printf("ERROR: no freq table\n");
-        return false;
+// the summary lines of the caches in use
+void print_cache_stats(sid2sng::Options const& options) {
+    if (DetectCache* cache = options.detect_cache) {
+        printf("auto-detect cache: %d hits, %d misses\n", cache->hits(), cache->misses());
     }
-    for (int i = 0; FREQ_HI[i] && *hi == FREQ_HI[i]; ++i) ++hi;
-    m_pos = hi - m_data.data();
-
-    if (m_autodetect) {
-        autodetect_options();
+    if (ConvertCache* cache = options.convert_cache) {
+        printf("conversion cache: %d hits, %d misses, %d evicted, %.1f MB\n",
+               cache->hits(), cache->misses(), cache->evictions(), cache->size() / (1024.0 * 1024));
     }
+}
 
-    // song table
-    std::vector<int> song_order_list_pos(m_song_count);
-    for (int& addr : song_order_list_pos) {
-        addr = read();
-        for (int i = 1; i < m_song.channels; ++i) {
-            read();
+
+// Converts all sid files below indir, mirroring the directory structure in
+// outdir or in pack if given. Conversions run in parallel, biggest files
+// first. If report is given, it receives the stats of every file. Unchanged
+// files that the index knows aren't GoatTracker2 sids are skipped, and so
+// are files whose relative path doesn't match glob.
+int run_batch(sid2sng::Options const& options, char const* indir, char const* outdir, int threads,
+              char const* glob, StatsReport* report, SidIndex const* index, PackWriter* pack) {
+    struct Job {
+        std::string sid;
+        std::string rel;
+        std::string sng;
+        uintmax_t   size;
+    };
+    std::vector<Job> jobs;
+    std::error_code  ec;
+    int skipped = 0;
+    for (fs::recursive_directory_iterator it(indir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!is_sid_file(*it, ec)) continue;
+        fs::path rel = it->path().lexically_relative(indir);
+        if (glob && !glob_match(glob, rel.generic_string().c_str())) continue;
+        if (index) {
+            int i = index->find(rel.generic_string());
+            if (i >= 0) {
+                SidIndex::Record r = index->record(i);
+                if (!r.probe.ok() && r.probe.error != sid2sng::ERR_OPEN &&
+                    r.size == it->file_size(ec) && r.mtime == mtime(*it, ec)) {
+                    ++skipped;
+                    continue;
+                }
+            }
         }
+        fs::path sng = pack ? rel : outdir / rel;
+        sng.replace_extension(".sng");
+        if (!pack) fs::create_directories(sng.parent_path(), ec);
+        jobs.push_back({ it->path().string(), rel.generic_string(), pack ? sng.generic_string() : sng.string(),
+                         it->file_size(ec) });
     }
-    for (int& addr : song_order_list_pos) {
-        addr |= read() << 8;
-        addr += m_addr_offset;
-        for (int i = 1; i < m_song.channels; ++i) {
-            read();
-        }
+    if (ec) {
+        fprintf(stderr, "ERROR: %s: %s\n", indir, ec.message().c_str());
+        return 1;
     }
+    std::stable_sort(jobs.begin(), jobs.end(), [](Job const& a, Job const& b) {
+        return a.size > b.size;
+    });
+
+    ThreadPool pool(threads);
+    std::vector<BatchScratch> scratch = make_scratch(options, pool.threads());
+    std::atomic<int> failed(0);
+    std::vector<sid2sng::Stats> stats(jobs.size());
+    std::vector<ThreadPool::Task> tasks;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        Job const& job = jobs[i];
+        sid2sng::Stats& st = stats[i];
+        tasks.push_back([&scratch, &failed, &job, &st, pack](int worker) {
+            sid2sng::Result res;
+            MappedFile      file;
+            if (!pack) {
+                res = scratch[worker].conv.convert_file(job.sid.c_str(), job.sng.c_str());
+            }
+            else if (!file.open(job.sid.c_str())) {
+                res.error = sid2sng::ERR_OPEN;
+                res.log   = "ERROR: could not open file\n";
+                pack->add(job.rel, job.sng, 0, res, ByteSpan());
+            }
+            else {
+                res = convert_to(file.span(), job.rel, job.sng, scratch[worker], pack);
+            }
+            if (!res.ok()) ++failed;
+            st = res.stats;
 
-    int patt_table_pos = m_pos;
-
-    // song order list
-    int patt_count = 0;
-    for (int i = 0; i < m_song_count; ++i) {
-        printf("SONG %d\n", i);
-
-        m_pos = song_order_list_pos[i];
-
-        for (int c = 0; c < m_song.channels; ++c) {
-            printf(" %d:", c);
-            int p = 0;
-            for (;;) {
-                int x = read();
-                if (x == gt::LOOPSONG) break;
-                if (x < gt::REPEAT) {
-                    m_song.songorder[i][c][p++] = x;
-                    patt_count = std::max(x + 1, patt_count);
-                    printf(" %02X", x);
-                }
-                else if (x < gt::TRANSDOWN) {
-                    // repeat
-                    // swap with previous byte (i.e., pattern index)
-                    m_song.songorder[i][c][p    ] = m_song.songorder[i][c][p - 1];
-                    m_song.songorder[i][c][p - 1] = x;
-                    ++p;
-                    printf(" R%X", x - gt::REPEAT + 1);
-                }
-                else {
-                    // transpose
-                    m_song.songorder[i][c][p++] = x;
-                    int q = x - gt::TRANSUP;
-                    printf(" %c%X", "+-"[q < 0], abs(q));
-                }
+            // one write per file keeps the output of workers apart
+            if (!res.log.empty()) {
+                std::string report = job.sid + "\n" + res.log;
+                fwrite(report.data(), 1, report.size(), stdout);
             }
-            // pattern end
-            int x = read();
-            m_song.songorder[i][c][p++] = 0xff;
-            m_song.songorder[i][c][p++] = x;
-            printf(" RST%02X\n", x);
-        }
+        });
+    }
+    pool.run(std::move(tasks));
+    if (report) {
+        for (size_t i = 0; i < jobs.size(); ++i) report->add(jobs[i].sid, stats[i]);
     }
 
+    printf("%d files, %d converted, %d failed\n",
+           (int) jobs.size(), (int) jobs.size() - failed, (int) failed);
+    if (index) printf("index: %d files skipped, not made with GoatTracker2\n", skipped);
+    print_cache_stats(options);
+    return failed ? 1 : 0;
+}
 
-    // patterns
-    int instr_count  = 0;
-    int max_table[4] = {};
 
-    for (int i = 0; m_pos < (int) m_data.size(); i++) {
-        if (i >= gt::MAX_PATT) {
-            printf("ERROR: too many patterns\n");
-            return false;
+// Converts the sid members of an archive, optionally only those matching
+// glob, to the same relative paths below outdir or in pack. Members are read
+// straight from the mapped archive, deflated ones into a buffer per worker.
+int run_archive(sid2sng::Options const& options, char const* filename, char const* outdir, int threads,
+                char const* glob, StatsReport* report, PackWriter* pack) {
+    Archive     archive;
+    std::string error;
+    if (!archive.open(filename, &error)) {
+        fprintf(stderr, "ERROR: %s: %s\n", filename, error.c_str());
+        return 1;
+    }
+    struct Job {
+        Archive::Member const* member;
+        std::string            sng;
+    };
+    std::vector<Job> jobs;
+    std::error_code  ec;
+    int unsafe = 0;
+    for (Archive::Member const& m : archive.members()) {
+        fs::path rel = fs::path(m.name).lexically_normal();
+        std::string ext = rel.extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext != ".sid" || (glob && !glob_match(glob, m.name.c_str()))) continue;
+        // don't write outside of outdir
+        if (rel.has_root_path() || rel.begin()->string() == "..") {
+            ++unsafe;
+            continue;
         }
-
-        printf("PATTERN %02X\n", i);
-
-        int prev_instr = 0;
-        int instr      = 0;
-        int cmd        = 0;
-        int arg        = 0;
-        int row_nr     = 0;
-
-        for (;;) {
-            prev_instr = instr;
-            if (peek() < 0x40) {
-                instr = read();
-                instr_count = std::max(instr_count, instr);
-            }
-
-            int note;
-            int repeat = 1;
-
-            int x = read();
-            if (x > gt::KEYON) {
-                repeat = 256 - x;
-                note = gt::REST;
-            }
-            else if (x >= gt::REST) {
-                note = x;
+        fs::path sng = pack ? rel : outdir / rel;
+        sng.replace_extension(".sng");
+        if (!pack) fs::create_directories(sng.parent_path(), ec);
+        jobs.push_back({ &m, pack ? sng.generic_string() : sng.string() });
+    }
+    std::stable_sort(jobs.begin(), jobs.end(), [](Job const& a, Job const& b) {
+        return a.member->size > b.member->size;
+    });
+
+    ThreadPool pool(threads);
+    std::vector<BatchScratch> scratch = make_scratch(options, pool.threads());
+    std::atomic<int> failed(0);
+    std::vector<sid2sng::Stats> stats(jobs.size());
+    std::vector<ThreadPool::Task> tasks;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        Job const& job = jobs[i];
+        sid2sng::Stats& st = stats[i];
+        tasks.push_back([&archive, &scratch, &failed, &job, &st, pack](int worker) {
+            BatchScratch&   s = scratch[worker];
+            sid2sng::Result res;
+            ByteSpan        sid;
+            std::string     error;
+            if (!archive.read(*job.member, s.sid, sid, &error)) {
+                res.error = sid2sng::ERR_OPEN;
+                res.log   = "ERROR: " + error + "\n";
+                if (pack) pack->add(job.member->name, job.sng, 0, res, ByteSpan());
             }
             else {
-                if (x >= gt::FIRSTNOTE) {
-                    note = x;
-                }
-                else {
-                    cmd  = x % 16;
-                    arg  = cmd ? read() : 0;
-                    note = x < gt::FXONLY ? read() : gt::REST;
-
-                    // inc tempo
-                    if (cmd == 0xf && arg >=2) ++arg;
-
-                    if ((cmd >= 0x1 && cmd <= 0x4) || cmd == 0xe) {
-                        max_table[gt::STBL] = std::max(max_table[gt::STBL], arg);
-                    }
-                    if (cmd >= 0x8 && cmd <= 0xa) {
-                        max_table[cmd - 0x8] = std::max(max_table[cmd - 0x8], arg);
-                    }
-                }
+                res = convert_to(sid, job.member->name, job.sng, s, pack);
             }
+            if (!res.ok()) ++failed;
+            st = res.stats;
 
-            while (repeat--) {
-                if (row_nr > gt::MAX_PATTROWS) {
-                    printf("ERROR: too many pattern rows\n");
-                    return false;
-                }
-                m_song.pattern[i][row_nr * 4 + 0] = note;
-                m_song.pattern[i][row_nr * 4 + 1] = instr != prev_instr ? instr : 0;
-                m_song.pattern[i][row_nr * 4 + 2] = cmd;
-                m_song.pattern[i][row_nr * 4 + 3] = arg;
-
-                printf(" %02X: ", row_nr++);
-                if      (note == gt::REST)   printf("...");
-                else if (note == gt::KEYOFF) printf("===");
-                else if (note == gt::KEYON)  printf("+++");
-                else printf("%c%c%d",
-                            "CCDDEFFGGAAB"[note % 12],
-                            "-#-#--#-#-#-"[note % 12],
-                            (note - gt::FIRSTNOTE) / 12);
-                printf(" %02X%X%02X\n", instr != prev_instr ? instr : 0, cmd, arg);
+            // one write per file keeps the output of workers apart
+            if (!res.log.empty()) {
+                std::string text = job.member->name + "\n" + res.log;
+                fwrite(text.data(), 1, text.size(), stdout);
             }
-
-            if (peek() == 0) break;
-        }
-        read();
-        m_song.pattern[i][row_nr * 4] = gt::ENDPATT;
+        });
+    }
+    pool.run(std::move(tasks));
+    if (report) {
+        for (size_t i = 0; i < jobs.size(); ++i) report->add(jobs[i].member->name, stats[i]);
     }
 
+    printf("%d files, %d converted, %d failed\n",
+           (int) jobs.size(), (int) jobs.size() - failed, (int) failed);
+    if (unsafe) printf("%d members skipped, their paths lead outside of %s\n", unsafe, outdir);
+    print_cache_stats(options);
+    return failed ? 1 : 0;
+}
 
-    // skip pattern table
-    m_pos = patt_table_pos + patt_count * 2;
 
-    // instruments
-    for (int i = 1; i <= instr_count; ++i) m_song.instr[i].ad = read();
-    for (int i = 1; i <= instr_count; ++i) m_song.instr[i].sr = read();
-    for (int i = 1; i <= instr_count; ++i) {
-        int x = read();
-        max_table[gt::WTBL] = std::max(max_table[gt::WTBL], x);
-        m_song.instr[i].ptr[gt::WTBL] = x;
-    }
-    if (!m_nopulse) {
-        for (int i = 1; i <= instr_count; ++i) {
-            int x = read();
-            max_table[gt::PTBL] = std::max(max_table[gt::PTBL], x);
-            m_song.instr[i].ptr[gt::PTBL] = x;
-        }
+// Probes all sid files below indir in parallel and writes the index: the
+// header fields, the freq table anchor, the player hash and the detected
+// features of each file. Later batch runs read it to skip other sids.
+int run_index(sid2sng::Options const& options, char const* indir, char const* filename, int threads) {
+    std::vector<SidIndex::Record> records;
+    std::vector<std::string>      paths;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(indir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!is_sid_file(*it, ec)) continue;
+        SidIndex::Record r;
+        r.path  = it->path().lexically_relative(indir).generic_string();
+        r.mtime = mtime(*it, ec);
+        records.push_back(r);
+        paths.push_back(it->path().string());
     }
-    if (!m_nofilter) {
-        for (int i = 1; i <= instr_count; ++i) {
-            int x = read();
-            max_table[gt::FTBL] = std::max(max_table[gt::FTBL], x);
-            m_song.instr[i].ptr[gt::FTBL] = x;
-        }
+    if (ec) {
+        fprintf(stderr, "ERROR: %s: %s\n", indir, ec.message().c_str());
+        return 1;
     }
-    if (!m_noinstrvib) {
-        for (int i = 1; i <= instr_count; ++i) {
-            int x = read();
-            max_table[gt::STBL] = std::max(max_table[gt::STBL], x);
-            m_song.instr[i].ptr[gt::STBL] = x;
-        }
-        for (int i = 1; i <= instr_count; ++i) m_song.instr[i].vibdelay = read();
+
+    std::vector<ThreadPool::Task> tasks;
+    for (size_t i = 0; i < records.size(); ++i) {
+        tasks.push_back([&options, &records, &paths, i](int) {
+            SidIndex::Record& r = records[i];
+            MappedFile file;
+            if (!file.open(paths[i].c_str())) {
+                r.probe.error = sid2sng::ERR_OPEN;
+                return;
+            }
+            r.size  = file.span().size();
+            r.hash  = SidIndex::hash(file.span());
+            r.probe = sid2sng::probe(file.span(), options);
+        });
     }
-    if (!m_fixedparams) {
-        for (int i = 1; i <= instr_count; ++i) m_song.instr[i].gatetimer = read();
-        for (int i = 1; i <= instr_count; ++i) m_song.instr[i].firstwave = read();
+    ThreadPool pool(threads);
+    pool.run(std::move(tasks));
+
+    int gt2 = 0, unreadable = 0;
+    for (SidIndex::Record const& r : records) {
+        gt2        += r.probe.ok();
+        unreadable += r.probe.error == sid2sng::ERR_OPEN;
     }
-    printf("INSTR\n");
-    for (int i = 1; i <= instr_count; ++i) {
-        auto const& instr = m_song.instr[i];
-        printf(" %02x: %02x %02x %02x %02x %02x %02x %02x %02x %02x\n", i,
-               instr.ad, instr.sr, instr.ptr[0], instr.ptr[1], instr.ptr[2], instr.ptr[3],
-               instr.vibdelay, instr.gatetimer, instr.firstwave);
+    if (!SidIndex::write(filename, std::move(records))) {
+        fprintf(stderr, "ERROR: could not write %s\n", filename);
+        return 1;
     }
+    printf("%d files, %d GoatTracker2 sids, %d others, %d unreadable\n",
+           (int) paths.size(), gt2, (int) paths.size() - gt2 - unreadable, unreadable);
+    return 0;
+}
 
 
-    // tables
-    for (int t = 0; t < gt::MAX_TABLES; ++t) {
-        if (t == gt::PTBL && m_nopulse) continue;
-        if (t == gt::FTBL && m_nofilter) continue;
-        // TODO: maybe skip speed table
-        printf("TABLE %d (min len %d)\n", t, max_table[t]);
-        if (t == gt::STBL) {
-            int x = read();
-            if (x != 0) {
-                printf("ERROR: speed table\n");
-                return false;
-            }
-        }
-        int x = 0;
-        for (int i = 0; i < max_table[t]; ++i) {
-            m_song.ltable[t][i] = x = read();
-        }
-        if (t < gt::STBL) {
-            while (x != 0xff) {
-                m_song.ltable[t][max_table[t]] = x = read();
-                ++max_table[t];
-            }
+// Worker mode for job queues: converts a stream of sids from stdin until
+// EOF, keeping the song, the buffers and the detect cache warm. Each record
+// is a little-endian uint32 size followed by that many bytes. A request
+// holds a sid file, the response holds
+//   uint32 error, uint32 features, uint32 warnings, uint32 log size,
+//   the log, then the GTS5 image, which is empty if there was an error.
+int run_worker(sid2sng::Options const& options) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    enum {
+        MAX_RECORD = 16 << 20,      // far above any sid, guards against garbage
+        HEADER     = 4 * 4,
+    };
+    sid2sng::Converter   conv(options);
+    std::vector<uint8_t> sid;
+    std::vector<uint8_t> response;
+    for (;;) {
+        uint8_t size[4];
+        size_t  got = fread(size, 1, 4, stdin);
+        if (got == 0 && feof(stdin)) return 0;
+        if (got != 4 || get32(size) > MAX_RECORD) {
+            fprintf(stderr, "ERROR: bad record size\n");
+            return 1;
         }
-        if (t == gt::STBL) {
-            // keep reading until we find a zero
-            while (peek() != 0) {
-                m_song.ltable[t][max_table[t]] = read();
-                ++max_table[t];
-            }
-            int x = read();
-            if (x != 0) {
-                printf("ERROR: speed table\n");
-                return false;
-            }
+        sid.resize(get32(size));
+        if (fread(sid.data(), 1, sid.size(), stdin) != sid.size()) {
+            fprintf(stderr, "ERROR: truncated record\n");
+            return 1;
         }
-        for (int i = 0; i < max_table[t]; ++i) {
-            // read rtable
-            m_song.rtable[t][i] = read();
-
-            // fix stuff
-            if (t == gt::WTBL) {
-                if (!m_nowavedelay) {
-                    int x = m_song.ltable[t][i];
-                    if (x > 0x1f && x < 0xf0) x -= 0x10;
-                    else if (x > 0x0f && x < 0x20) x += 0xd0;
-                    m_song.ltable[t][i] = x;
-                }
 
-                // flip bit
-                if (m_song.ltable[t][i] < gt::WAVECMD) m_song.rtable[t][i] ^= 0x80;
-            }
-            if (t == gt::FTBL) {
-                int x = m_song.ltable[t][i];
-                if (x > 0x80 && x < 0xff) {
-                    m_song.ltable[t][i] = (x << 1) | 0x80;
-                }
-            }
-            if (t == gt::STBL) {
-                uint8_t x = m_song.ltable[t][i];
-                if ((x >= 0xf1 && x <= 0xf4) || x == 0xfe) {
-                    max_table[gt::STBL] = std::max<int>(max_table[gt::STBL], m_song.rtable[t][i]);
-                }
-            }
-
-            printf(" %02X: %02X %02X\n", i + 1, m_song.ltable[t][i], m_song.rtable[t][i]);
+        sid2sng::Result const& res = conv.convert(ByteSpan(sid.data(), sid.size()));
+        ByteSpan               sng = conv.sng();
+
+        response.resize(4 + HEADER + res.log.size() + sng.size());
+        uint8_t* p = response.data();
+        put32(p, response.size() - 4);
+        put32(p + 4, res.error);
+        put32(p + 8, res.features);
+        put32(p + 12, res.warnings);
+        put32(p + 16, res.log.size());
+        std::copy(res.log.begin(), res.log.end(), p + 4 + HEADER);
+        std::copy(sng.begin(), sng.end(), p + 4 + HEADER + res.log.size());
+        if (fwrite(response.data(), 1, response.size(), stdout) != response.size() || fflush(stdout) != 0) {
+            return 1;
         }
     }
-
-
-    // sanity check
-    if (m_pos > song_order_list_pos[0]) {
-        printf("WARNING: read tables past order list (%d > %d)\n", m_pos, song_order_list_pos[0]);
-    }
-    if (m_pos < song_order_list_pos[0]) {
-        printf("WARNING: not all table data was read (%d < %d)\n", m_pos, song_order_list_pos[0]);
-    }
-
-    return m_song.save(m_sng_filename);
 }
 
 
 int main(int argc, char** argv) {
-    Sid2Song convert;
+    sid2sng::Options options;
+    bool        batch   = false;
+    bool        worker  = false;
+    bool        build_index = false;
+    bool        watch   = false;
+    int         level   = -1;
+    int         threads = std::max<int>(1, std::thread::hardware_concurrency());
+    char const* indir   = nullptr;
+    char const* outdir  = nullptr;
+    char const* cache_filename = nullptr;
+    char const* cache_dir      = nullptr;
+    char const* index_filename = nullptr;
+    char const* glob           = nullptr;
+    bool        pack_output    = false;
+    int         cache_mb       = 256;
+    int         stats          = -1;
+    DetectCache cache;
+    ConvertCache convert_cache;
     int index = 0;
     for (int i = 1; i < argc; ++i) {
         char const* a = argv[i];
-        if (a[0] != '-') {
-            if      (index == 0) convert.m_sid_filename = a;
-            else if (index == 1) convert.m_sng_filename = a;
+        if (a[0] != '-' || a[1] == '\0') {
+            if      (index == 0) indir  = a;
+            else if (index == 1) outdir = a;
             else if (index >= 2) goto USAGE;
             ++index;
             continue;
         }
         std::string s = a;
-        if      (s == "-nopulse")     convert.m_nopulse     = true;
-        else if (s == "-nofilter")    convert.m_nofilter    = true;
-        else if (s == "-noinstrvib")  convert.m_noinstrvib  = true;
-        else if (s == "-fixedparams") convert.m_fixedparams = true;
-        else if (s == "-nowavedelay") convert.m_nowavedelay = true;
-        else if (s == "-noautodetect")convert.m_autodetect  = false;
+        if      (s == "-batch")       batch = true;
+        else if (s == "-worker")      worker = true;
+        else if (s == "-index")       build_index = true;
+        else if (s == "-pack")        pack_output = true;
+        else if (s == "-watch")       watch = true;
+        else if (s == "-j" && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (s == "-q")           level = LOG_ERROR;
+        else if (s == "-v")           level = LOG_VERBOSE;
+        else if (s == "-nopulse")     options.features |= sid2sng::NOPULSE;
+        else if (s == "-nofilter")    options.features |= sid2sng::NOFILTER;
+        else if (s == "-noinstrvib")  options.features |= sid2sng::NOINSTRVIB;
+        else if (s == "-fixedparams") options.features |= sid2sng::FIXEDPARAMS;
+        else if (s == "-nowavedelay") options.features |= sid2sng::NOWAVEDELAY;
+        else if (s == "-noautodetect")options.autodetect = false;
+        else if (s == "-search")      options.search = true;
+        else if (s == "-emulate")     options.emulate = true;
+        else if (s == "-optimize")    options.optimize = true;
+        else if (s == "-detectcache" && i + 1 < argc) cache_filename = argv[++i];
+        else if (s == "-cache" && i + 1 < argc)       cache_dir = argv[++i];
+        else if (s == "-useindex" && i + 1 < argc)    index_filename = argv[++i];
+        else if (s == "-glob" && i + 1 < argc)        glob = argv[++i];
+        else if (s == "-stats" && i + 1 < argc) {
+            std::string f = argv[++i];
+            if      (f == "table") stats = STATS_TABLE;
+            else if (f == "json")  stats = STATS_JSON;
+            else goto USAGE;
+        }
+        else if (s == "-cachesize" && i + 1 < argc)   cache_mb = std::max(1, atoi(argv[++i]));
         else goto USAGE;
     }
-    if (index == 0) goto USAGE;
-    return convert.run() ? 0 : 1;
+    if (index == 0 && !worker) goto USAGE;
+    if (cache_filename) {
+        if (!cache.load(cache_filename)) {
+            fprintf(stderr, "WARNING: ignoring bad detect cache %s\n", cache_filename);
+        }
+        options.detect_cache = &cache;
+    }
+    options.stats = stats >= 0;
+    if (cache_dir) {
+        if (!convert_cache.open(cache_dir, uint64_t(cache_mb) << 20)) {
+            fprintf(stderr, "ERROR: could not open cache directory %s\n", cache_dir);
+            return 1;
+        }
+        options.convert_cache = &convert_cache;
+    }
+    if (worker) {
+        if (index != 0 || batch) goto USAGE;
+        options.log_level = level < 0 ? LOG_ERROR : LogLevel(level);
+        options.search_threads = threads;
+        // without a cache file, known players are still remembered in memory
+        options.detect_cache = &cache;
+        int ret = run_worker(options);
+        if (cache_filename && cache.dirty() && !cache.save(cache_filename)) {
+            fprintf(stderr, "ERROR: could not write %s\n", cache_filename);
+        }
+        return ret;
+    }
+    if (build_index) {
+        if (index != 2 || batch) goto USAGE;
+        options.log_level = LOG_ERROR;
+        options.search_threads = 1;
+        // players repeat a lot in a collection, scan each only once
+        options.detect_cache = &cache;
+        int ret = run_index(options, indir, outdir, threads);
+        if (cache_filename && cache.dirty() && !cache.save(cache_filename)) {
+            fprintf(stderr, "ERROR: could not write %s\n", cache_filename);
+        }
+        return ret;
+    }
+    if (watch) {
+        if (index != 2 || batch) goto USAGE;
+        options.log_level = level < 0 ? LOG_ERROR : LogLevel(level);
+        options.search_threads = 1;
+        // a running watcher sees the same players over and over
+        options.detect_cache = &cache;
+        int ret = run_watch(options, indir, outdir, threads);
+        if (cache_filename && cache.dirty() && !cache.save(cache_filename)) {
+            fprintf(stderr, "ERROR: could not write %s\n", cache_filename);
+        }
+        return ret;
+    }
+    if (batch) {
+        if (index != 2) goto USAGE;
+        SidIndex sid_index;
+        std::string error;
+        if (index_filename && !sid_index.open(index_filename, &error)) {
+            fprintf(stderr, "ERROR: %s: %s\n", index_filename, error.c_str());
+            return 1;
+        }
+        // only report problems unless asked otherwise
+        options.log_level = level < 0 ? LOG_ERROR : LogLevel(level);
+        // files are already converted in parallel
+        options.search_threads = 1;
+        StatsReport report;
+        PackWriter pack;
+        if (pack_output && !pack.open(outdir)) {
+            fprintf(stderr, "ERROR: could not create %s\n", outdir);
+            return 1;
+        }
+        std::error_code ec;
+        int ret = fs::is_regular_file(indir, ec)
+                ? run_archive(options, indir, outdir, threads, glob, stats >= 0 ? &report : nullptr,
+                              pack_output ? &pack : nullptr)
+                : run_batch(options, indir, outdir, threads, glob, stats >= 0 ? &report : nullptr,
+                            index_filename ? &sid_index : nullptr, pack_output ? &pack : nullptr);
+        if (pack_output && !pack.finish()) {
+            fprintf(stderr, "ERROR: could not write %s\n", outdir);
+            ret = 1;
+        }
+        if (stats >= 0) {
+            std::string text = report.format(StatsFormat(stats));
+            fwrite(text.data(), 1, text.size(), stdout);
+        }
+        if (cache_filename && cache.dirty() && !cache.save(cache_filename)) {
+            fprintf(stderr, "ERROR: could not write %s\n", cache_filename);
+        }
+        return ret;
+    }
+    options.log_level = level < 0 ? LOG_SUMMARY : LogLevel(level);
+    options.search_threads = threads;
+    {
+        char const* sng = outdir ? outdir : "out.sng";
+        // keep stdout clean when the song is written there
+        bool to_stdout = strcmp(sng, "-") == 0;
+#ifdef _WIN32
+        if (to_stdout) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        sid2sng::Result res = sid2sng::convert_file(indir, sng, options);
+        FILE* out = to_stdout ? stderr : stdout;
+        fwrite(res.log.data(), 1, res.log.size(), out);
+        if (stats >= 0) {
+            std::string text = format_stats(res.stats, StatsFormat(stats));
+            fwrite(text.data(), 1, text.size(), out);
+        }
+        fflush(out);
+        if (cache_filename && cache.dirty() && !cache.save(cache_filename)) {
+            fprintf(stderr, "ERROR: could not write %s\n", cache_filename);
+        }
+        return res.ok() ? 0 : 1;
+    }
 
 USAGE:
     fprintf(stderr, "usage: %s [options...] sid-file [sng-file]\n", argv[0]);
-    fprintf(stderr, " -nopulse\n"
+    fprintf(stderr, "       %s [options...] -batch sid-dir|archive sng-dir [-j threads]\n", argv[0]);
+    fprintf(stderr, "       %s [options...] -worker < requests > responses\n", argv[0]);
+    fprintf(stderr, "       %s [options...] -index sid-dir index-file [-j threads]\n", argv[0]);
+    fprintf(stderr, "       %s [options...] -watch sid-dir sng-dir [-j threads]\n", argv[0]);
+    fprintf(stderr, " -q           only print errors and warnings\n"
+                    " -v           dump the decoded song\n"
+                    " -nopulse\n"
                     " -nofilter\n"
                     " -noinstrvib\n"
                     " -fixedparams\n"
                     " -nowavedelay\n"
-                    " -noautodetect\n");
+                    " -noautodetect\n"
+                    " -search      try all feature combinations if decoding fails\n"
+                    " -emulate     run the player to pick a -search result\n"
+                    " -optimize    merge duplicate patterns, drop unused ones\n"
+                    " -detectcache file  reuse auto-detect results of known players\n"
+                    " -cache dir   reuse earlier conversions of identical sids\n"
+                    " -cachesize mb  size limit of the -cache directory (default: 256)\n"
+                    " -useindex file  skip files the index found not to be GoatTracker2 sids\n"
+                    " -glob pattern  only convert the batch files matching pattern\n"
+                    " -pack        write the batch songs into one indexed tar file sng-dir\n"
+                    " -stats table|json  print stage times and counters, percentiles in batch mode\n");
     return 1;
 }
@@ -0,0 +1,87 @@
+#include "mapfile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+
+bool MappedFile::open(char const* filename) {
+    close();
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+    m_size = (size_t) size.QuadPart;
+    if (m_size == 0) {
+        // empty files can't be mapped
+        CloseHandle(file);
+        return true;
+    }
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!m_mapping) {
+        m_size = 0;
+        return false;
+    }
+    m_data = (uint8_t const*) MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close() {
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(m_mapping);
+    m_data    = nullptr;
+    m_size    = 0;
+    m_mapping = nullptr;
+}
+
+#else
+
+bool MappedFile::open(char const* filename) {
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+    m_size = st.st_size;
+    if (m_size == 0) {
+        // empty files can't be mapped
+        ::close(fd);
+        return true;
+    }
+    void* p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        m_size = 0;
+        return false;
+    }
+    m_data = (uint8_t const*) p;
+    return true;
+}
+
+void MappedFile::close() {
+    if (m_data) munmap((void*) m_data, m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+#endif
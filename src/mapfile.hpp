@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+
+// Read-only view of contiguous bytes.
+class ByteSpan {
+public:
+    ByteSpan() = default;
+    ByteSpan(uint8_t const* data, size_t size) : m_data(data), m_size(size) {}
+
+    uint8_t const* data() const { return m_data; }
+    size_t         size() const { return m_size; }
+    bool           empty() const { return m_size == 0; }
+    uint8_t const* begin() const { return m_data; }
+    uint8_t const* end() const { return m_data + m_size; }
+    uint8_t        operator[](size_t i) const { return m_data[i]; }
+
+    ByteSpan subspan(size_t offset, size_t count) const {
+        if (offset > m_size) offset = m_size;
+        if (count > m_size - offset) count = m_size - offset;
+        return { m_data + offset, count };
+    }
+
+private:
+    uint8_t const* m_data = nullptr;
+    size_t         m_size = 0;
+};
+
+
+// Maps a whole file read-only into memory.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(char const* filename);
+    void close();
+
+    ByteSpan span() const { return { m_data, m_size }; }
+
+private:
+    uint8_t const* m_data = nullptr;
+    size_t         m_size = 0;
+#ifdef _WIN32
+    void*          m_mapping = nullptr;
+#endif
+};
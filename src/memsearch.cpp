@@ -0,0 +1,174 @@
+#include "memsearch.hpp"
+#include <algorithm>
+#include <cstring>
+
+// SSE2 is part of the x86-64 baseline
+#if defined(__x86_64__) || defined(_M_X64)
+#define MEMSEARCH_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+
+namespace {
+
+enum { MAX_PAIRS = 32 };
+
+int ctz(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return i;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+int max_distance(BytePair const* pairs, int count) {
+    int d = 0;
+    for (int k = 0; k < count; ++k) d = std::max<int>(d, pairs[k].distance);
+    return d;
+}
+
+size_t find_pairs_scalar(uint8_t const* h, size_t len, size_t pos, BytePair const* pairs, int count) {
+    for (; pos < len; ++pos) {
+        for (int k = 0; k < count; ++k) {
+            BytePair const& p = pairs[k];
+            if (h[pos] == p.first && pos + p.distance < len && h[pos + p.distance] == p.last) return pos;
+        }
+    }
+    return len;
+}
+
+
+#ifdef MEMSEARCH_X86
+
+size_t find_pairs_sse2(uint8_t const* h, size_t len, size_t pos, BytePair const* pairs, int count) {
+    count = std::min<int>(count, MAX_PAIRS);
+    __m128i first[MAX_PAIRS];
+    __m128i last[MAX_PAIRS];
+    for (int k = 0; k < count; ++k) {
+        first[k] = _mm_set1_epi8(pairs[k].first);
+        last[k]  = _mm_set1_epi8(pairs[k].last);
+    }
+    size_t end = max_distance(pairs, count) + 16;
+    for (; pos + end <= len; pos += 16) {
+        __m128i  block = _mm_loadu_si128((__m128i const*) (h + pos));
+        uint32_t mask  = 0;
+        for (int k = 0; k < count; ++k) {
+            __m128i f = _mm_cmpeq_epi8(block, first[k]);
+            __m128i l = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i const*) (h + pos + pairs[k].distance)), last[k]);
+            mask |= _mm_movemask_epi8(_mm_and_si128(f, l));
+        }
+        if (mask) return pos + ctz(mask);
+    }
+    return find_pairs_scalar(h, len, pos, pairs, count);
+}
+
+TARGET_AVX2
+size_t find_pairs_avx2(uint8_t const* h, size_t len, size_t pos, BytePair const* pairs, int count) {
+    count = std::min<int>(count, MAX_PAIRS);
+    __m256i first[MAX_PAIRS];
+    __m256i last[MAX_PAIRS];
+    for (int k = 0; k < count; ++k) {
+        first[k] = _mm256_set1_epi8(pairs[k].first);
+        last[k]  = _mm256_set1_epi8(pairs[k].last);
+    }
+    size_t end = max_distance(pairs, count) + 32;
+    for (; pos + end <= len; pos += 32) {
+        __m256i  block = _mm256_loadu_si256((__m256i const*) (h + pos));
+        uint32_t mask  = 0;
+        for (int k = 0; k < count; ++k) {
+            __m256i f = _mm256_cmpeq_epi8(block, first[k]);
+            __m256i l = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const*) (h + pos + pairs[k].distance)), last[k]);
+            mask |= _mm256_movemask_epi8(_mm256_and_si256(f, l));
+        }
+        if (mask) return pos + ctz(mask);
+    }
+    return find_pairs_sse2(h, len, pos, pairs, count);
+}
+
+bool has_avx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = info[2] & (1 << 27);
+    bool avx     = info[2] & (1 << 28);
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+
+FindPairsImpl const& impl() {
+    static FindPairsImpl const impl = [] {
+#ifdef MEMSEARCH_X86
+        if (has_avx2()) return FindPairsImpl{ find_pairs_avx2, "avx2" };
+        return FindPairsImpl{ find_pairs_sse2, "sse2" };
+#else
+        return FindPairsImpl{ find_pairs_scalar, "scalar" };
+#endif
+    }();
+    return impl;
+}
+
+} // namespace
+
+
+size_t find_pairs(uint8_t const* h, size_t len, size_t pos, BytePair const* pairs, int count) {
+    return impl().func(h, len, pos, pairs, count);
+}
+
+char const* find_pairs_impl() {
+    return impl().name;
+}
+
+int find_pairs_impls(FindPairsImpl* impls, int max) {
+    FindPairsImpl all[] = {
+        impl(),
+#ifdef MEMSEARCH_X86
+        { find_pairs_sse2, "sse2" },
+#endif
+        { find_pairs_scalar, "scalar" },
+    };
+    int n = 0;
+    for (FindPairsImpl const& i : all) {
+        if (n < max && (n == 0 || i.func != impl().func)) impls[n++] = i;
+    }
+    return n;
+}
+
+
+uint8_t const* find_mem(uint8_t const* haystack, size_t haystack_len, uint8_t const* needle, size_t needle_len) {
+    return find_mem(impl().func, haystack, haystack_len, needle, needle_len);
+}
+
+uint8_t const* find_mem(FindPairs func, uint8_t const* haystack, size_t haystack_len, uint8_t const* needle,
+                        size_t needle_len) {
+    if (needle_len == 0) return haystack;
+    if (needle_len > haystack_len || needle_len > MAX_NEEDLE) return nullptr;
+    BytePair pair = { needle[0], needle[needle_len - 1], uint16_t(needle_len - 1) };
+    size_t   last = haystack_len - needle_len;
+    for (size_t pos = 0; ; ++pos) {
+        pos = func(haystack, haystack_len, pos, &pair, 1);
+        if (pos > last) return nullptr;
+        if (needle_len <= 2 || memcmp(haystack + pos + 1, needle + 1, needle_len - 2) == 0) {
+            return haystack + pos;
+        }
+    }
+}
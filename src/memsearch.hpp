@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Vectorized substring search. Candidates are filtered on a pair of bytes
+// at a fixed distance (typically the first and last byte of a needle) with
+// SSE2 or AVX2, chosen at runtime, and only then verified.
+
+struct BytePair {
+    uint8_t  first;
+    uint8_t  last;
+    uint16_t distance;
+};
+
+// Returns the first position >= pos where any of the pairs matches, i.e.
+// h[p] == first and h[p + distance] == last, or len if there is none.
+size_t find_pairs(uint8_t const* h, size_t len, size_t pos, BytePair const* pairs, int count);
+using FindPairs = size_t (*)(uint8_t const* h, size_t len, size_t pos, BytePair const* pairs, int count);
+
+// Returns a pointer to the first occurrence of needle, or nullptr. Needles
+// are at most MAX_NEEDLE bytes.
+uint8_t const* find_mem(uint8_t const* haystack, size_t haystack_len, uint8_t const* needle, size_t needle_len);
+// same, with the given implementation of find_pairs
+uint8_t const* find_mem(FindPairs func, uint8_t const* haystack, size_t haystack_len, uint8_t const* needle,
+                        size_t needle_len);
+enum { MAX_NEEDLE = 0xffff };
+
+// name of the implementation picked for this CPU
+char const* find_pairs_impl();
+
+// The implementations this CPU can run, the picked one first, so tests can
+// check them all.
+struct FindPairsImpl {
+    FindPairs   func;
+    char const* name;
+};
+int find_pairs_impls(FindPairsImpl* impls, int max);
@@ -0,0 +1,166 @@
+#include "packedpattern.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+
+namespace {
+
+enum {
+    FIRSTINSTR = 0x40,  // smaller bytes at the start of a row set the instrument
+    // Longest packed row: instrument, command, argument and note, plus the
+    // first byte of the next row.
+    MAX_ROW_BYTES = 5,
+    FILL_ROWS     = 32,   // rows written at once
+};
+
+// what a row's first byte after the instrument means
+struct ByteClass {
+    uint8_t note;       // unless read from the next byte
+    uint8_t rows;       // > 1 for rest runs
+    uint8_t run;        // counted as a rest run
+    uint8_t fx;         // sets cmd and arg
+    uint8_t cmd;
+    uint8_t arg_bytes;  // 1 if the argument follows
+    uint8_t note_bytes; // 1 if the note follows
+    uint8_t table;      // max_table slot of the argument
+};
+
+constexpr std::array<ByteClass, 256> make_classes() {
+    std::array<ByteClass, 256> classes = {};
+    for (int x = 0; x < 256; ++x) {
+        ByteClass c = { uint8_t(x), 1, 0, 0, 0, 0, 0, gt::MAX_TABLES };
+        if (x > gt::KEYON) {
+            c.note = gt::REST;
+            c.rows = 256 - x;
+            c.run  = 1;
+        }
+        else if (x < gt::FIRSTNOTE) {
+            c.note       = gt::REST;
+            c.fx         = 1;
+            c.cmd        = x % 16;
+            c.arg_bytes  = c.cmd != 0;
+            c.note_bytes = x < gt::FXONLY;
+            if ((c.cmd >= gt::CMD_PORTAUP && c.cmd <= gt::CMD_VIBRATO) || c.cmd == gt::CMD_FUNKTEMPO) {
+                c.table = gt::STBL;
+            }
+            if (c.cmd >= gt::CMD_SETWAVEPTR && c.cmd <= gt::CMD_SETFILTERPTR) {
+                c.table = c.cmd - gt::CMD_SETWAVEPTR;
+            }
+        }
+        classes[x] = c;
+    }
+    return classes;
+}
+
+constexpr std::array<ByteClass, 256> CLASSES = make_classes();
+
+// a row as it is laid out in memory
+uint32_t row_bytes(int note, int instr, int cmd, int arg) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return uint32_t(note) << 24 | instr << 16 | cmd << 8 | arg;
+#else
+    return note | instr << 8 | cmd << 16 | uint32_t(arg) << 24;
+#endif
+}
+
+} // namespace
+
+
+gt::UnpackResult gt::unpack_pattern(uint8_t const* data, int size, int& pos, uint8_t* pattern, int& rows,
+                                    UnpackState& state) {
+    // The last rows are read from a zero padded copy, so rows never need
+    // bounds checks. Reading past the end is caught after each row.
+    uint8_t        tail[MAX_ROW_BYTES * 2];
+    uint8_t const* p       = data + pos;
+    uint8_t const* end     = data + size;
+    bool           in_tail = false;
+
+    // the state is kept in locals, the row stores could alias it
+    int instr_count = state.instr_count;
+    int repeats     = state.repeats;
+    int max_table[MAX_TABLES + 1];
+    std::copy(state.max_table, state.max_table + MAX_TABLES + 1, max_table);
+
+    UnpackResult result    = UNPACK_OK;
+    bool         truncated = false;
+    uint8_t scratch[(MAX_PATTROWS + FILL_ROWS) * 4];
+    int n     = 0;
+    int instr = 0;
+    int cmd   = 0;
+    int arg   = 0;
+    for (;;) {
+        if (!in_tail && end - p < MAX_ROW_BYTES) {
+            int left = int(end - p);
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, left);
+            p       = tail;
+            end     = tail + left;
+            in_tail = true;
+        }
+
+        // selects instead of branches, the operand bytes are always there
+        int prev_instr = instr;
+        int has_instr  = *p < FIRSTINSTR;
+        instr          = has_instr ? *p : instr;
+        p             += has_instr;
+        instr_count    = std::max(instr_count, instr);
+        if (p >= end) {
+            result    = UNPACK_TRUNCATED;
+            truncated = true;
+            break;
+        }
+
+        ByteClass const& c = CLASSES[*p++];
+        int fx_arg = c.arg_bytes ? *p : 0;
+        p         += c.arg_bytes;
+        int note   = c.note_bytes ? *p : c.note;
+        p         += c.note_bytes;
+        cmd        = c.fx ? c.cmd : cmd;
+        arg        = c.fx ? fx_arg : arg;
+        // inc tempo
+        arg       += c.fx & (cmd == CMD_SETTEMPO) & (arg >= 2);
+        max_table[c.table] = std::max(max_table[c.table], arg);
+        repeats += c.run;
+
+        if (n + c.rows > MAX_PATTROWS) {
+            result    = UNPACK_TOO_MANY_ROWS;
+            truncated = p > end;
+            break;
+        }
+        // Rows go to a scratch buffer with room for a whole fill past the
+        // last row, so runs up to FILL_ROWS need no loop. Single rows, most
+        // of them, are one store. Bytes past the end mark are saved with the
+        // song, so they must not change in pattern.
+        uint32_t row = row_bytes(note, instr != prev_instr ? instr : 0, cmd, arg);
+        if (c.rows == 1) {
+            memcpy(scratch + n * 4, &row, 4);
+        }
+        else {
+            uint64_t two = uint64_t(row) << 32 | row;
+            uint64_t fill[FILL_ROWS / 2];
+            std::fill(fill, fill + FILL_ROWS / 2, two);
+            for (int i = 0; i < c.rows; i += FILL_ROWS) memcpy(scratch + (n + i) * 4, fill, sizeof(fill));
+        }
+        n += c.rows;
+
+        // cut short, or the terminator is missing
+        if (p >= end) {
+            truncated = true;
+            break;
+        }
+        if (*p == 0) {
+            ++p;
+            break;
+        }
+    }
+    memcpy(pattern, scratch, n * 4);
+    if (result == UNPACK_OK) pattern[n * 4] = ENDPATT;
+    if (truncated) state.truncated = true;
+    pos = size - std::max(int(end - p), 0);
+    rows = n;
+    state.instr_count = instr_count;
+    state.repeats     = repeats;
+    std::copy(max_table, max_table + MAX_TABLES + 1, state.max_table);
+    return result;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include "gsong.hpp"
+
+namespace gt {
+
+// Carried from one pattern to the next.
+struct UnpackState {
+    int  instr_count = 0;
+    // highest table index referenced by a command; the last slot takes the
+    // arguments of all other commands
+    int  max_table[MAX_TABLES + 1] = {};
+    int  repeats   = 0;     // rest runs
+    bool truncated = false; // the data ended early, missing bytes read as 0
+};
+
+enum UnpackResult {
+    UNPACK_OK,
+    UNPACK_TRUNCATED,       // the data ends before the note byte of a row
+    UNPACK_TOO_MANY_ROWS,
+};
+
+// Unpacks the player's pattern at data[pos] into the row format of
+// Song::pattern, including the end mark, and moves pos past the terminating
+// zero. If only operands or the terminator are missing, the pattern is
+// finished and state.truncated is set. Bytes are classified with a lookup
+// table and rest runs are filled in bulk.
+UnpackResult unpack_pattern(uint8_t const* data, int size, int& pos, uint8_t* pattern, int& rows, UnpackState& state);
+
+} // namespace gt
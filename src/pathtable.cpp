@@ -0,0 +1,28 @@
+#include "pathtable.hpp"
+#include <algorithm>
+#include <cstring>
+#include "bytes.hpp"
+
+
+ByteSpan PathTable::path(int i) const {
+    // the ranges are checked here instead of when opening, which stays O(1)
+    uint32_t offset = get32(rec(i) + m_path_field);
+    uint32_t len    = get32(rec(i) + m_path_field + 4);
+    if (offset > m_paths_size || len > m_paths_size - offset) return {};
+    return { m_paths + offset, len };
+}
+
+int PathTable::find(std::string const& path) const {
+    int lo = 0, hi = m_count;
+    while (lo < hi) {
+        int      mid = lo + (hi - lo) / 2;
+        ByteSpan p   = this->path(mid);
+        size_t   n   = std::min(p.size(), path.size());
+        int c = n ? memcmp(p.data(), path.data(), n) : 0;
+        if (c == 0) c = p.size() < path.size() ? -1 : p.size() > path.size();
+        if (c == 0) return mid;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
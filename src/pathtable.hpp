@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "mapfile.hpp"
+
+// Fixed size records sorted by path, followed by the path bytes, as in the
+// sid index and song packs. A record holds the offset and length of its
+// path as little-endian uint32s, at path_field.
+class PathTable {
+public:
+    PathTable() = default;
+    PathTable(uint8_t const* records, uint32_t count, int record_size, int path_field, uint32_t paths_size)
+        : m_records(records), m_paths(records + size_t(count) * record_size), m_count(count),
+          m_paths_size(paths_size), m_record_size(record_size), m_path_field(path_field) {}
+
+    int            size() const { return m_count; }
+    uint8_t const* records() const { return m_records; }
+    uint8_t const* rec(int i) const { return m_records + size_t(i) * m_record_size; }
+    // empty if the record points outside the path bytes
+    ByteSpan       path(int i) const;
+    // index of the record, or -1
+    int            find(std::string const& path) const;
+
+private:
+    uint8_t const* m_records     = nullptr;
+    uint8_t const* m_paths       = nullptr;
+    uint32_t       m_count       = 0;
+    uint32_t       m_paths_size  = 0;
+    int            m_record_size = 0;
+    int            m_path_field  = 0;
+};
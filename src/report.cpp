@@ -0,0 +1,197 @@
+#include "report.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+
+
+namespace {
+
+// JSON keys of the stages
+char const* const STAGE_KEYS[] = {
+    "load",
+    "freq_table",
+    "autodetect",
+    "order_lists",
+    "patterns",
+    "instruments",
+    "optimize",
+    "save",
+};
+static_assert(sizeof(STAGE_KEYS) / sizeof(*STAGE_KEYS) == sid2sng::STAGE_COUNT, "missing stage key");
+
+enum {
+    SLOWEST = 5,    // files listed as outliers
+};
+
+void appendf(std::string& s, char const* fmt, ...) {
+    char    buf[512];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    s.append(buf, std::min<int>(std::max(n, 0), sizeof(buf) - 1));
+}
+
+std::string json_string(std::string const& s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if (c < 0x20) {
+            appendf(out, "\\u%04x", c);
+        }
+        else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+uint64_t total_ns(sid2sng::Stats const& stats) {
+    uint64_t t = 0;
+    for (uint64_t ns : stats.ns) t += ns;
+    return t;
+}
+
+double us(uint64_t ns) { return ns / 1000.0; }
+
+// nearest rank, v is sorted
+uint64_t percentile(std::vector<uint64_t> const& v, double p) {
+    if (v.empty()) return 0;
+    size_t rank = (size_t) std::ceil(p / 100 * v.size());
+    return v[std::min(std::max<size_t>(rank, 1), v.size()) - 1];
+}
+
+struct Summary {
+    uint64_t sum = 0;
+    double   mean = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t max = 0;
+};
+
+Summary summarize(std::vector<uint64_t> v) {
+    Summary s;
+    if (v.empty()) return s;
+    std::sort(v.begin(), v.end());
+    for (uint64_t x : v) s.sum += x;
+    s.mean = double(s.sum) / v.size();
+    s.p50  = percentile(v, 50);
+    s.p90  = percentile(v, 90);
+    s.p99  = percentile(v, 99);
+    s.max  = v.back();
+    return s;
+}
+
+void counters(std::string& s, uint64_t bytes, uint64_t patterns, uint64_t rows, uint64_t repeats, StatsFormat format) {
+    if (format == STATS_JSON) {
+        appendf(s, "\"counters\":{\"bytes_scanned\":%llu,\"patterns\":%llu,\"rows\":%llu,\"repeats\":%llu}",
+                (unsigned long long) bytes, (unsigned long long) patterns,
+                (unsigned long long) rows, (unsigned long long) repeats);
+    }
+    else {
+        appendf(s, "%llu bytes scanned, %llu patterns, %llu rows, %llu repeats\n",
+                (unsigned long long) bytes, (unsigned long long) patterns,
+                (unsigned long long) rows, (unsigned long long) repeats);
+    }
+}
+
+} // namespace
+
+
+std::string format_stats(sid2sng::Stats const& stats, StatsFormat format) {
+    std::string s;
+    if (format == STATS_JSON) {
+        appendf(s, "{\"cache_hit\":%s,\"stages_us\":{", stats.cache_hit ? "true" : "false");
+        for (int i = 0; i < sid2sng::STAGE_COUNT; ++i) {
+            appendf(s, "%s\"%s\":%.3f", i ? "," : "", STAGE_KEYS[i], us(stats.ns[i]));
+        }
+        appendf(s, "},\"total_us\":%.3f,", us(total_ns(stats)));
+        counters(s, stats.bytes_scanned, stats.patterns, stats.rows, stats.repeats, format);
+        s += "}\n";
+        return s;
+    }
+    if (stats.cache_hit) s += "conversion cache hit\n";
+    appendf(s, " %-14s %10s\n", "stage", "us");
+    for (int i = 0; i < sid2sng::STAGE_COUNT; ++i) {
+        appendf(s, " %-14s %10.3f\n", sid2sng::stage_name(sid2sng::Stage(i)), us(stats.ns[i]));
+    }
+    appendf(s, " %-14s %10.3f\n", "total", us(total_ns(stats)));
+    counters(s, stats.bytes_scanned, stats.patterns, stats.rows, stats.repeats, format);
+    return s;
+}
+
+
+void StatsReport::add(std::string const& name, sid2sng::Stats const& stats) {
+    if (stats.cache_hit) {
+        ++m_cache_hits;
+        return;
+    }
+    m_files.push_back({ name, stats, total_ns(stats) });
+}
+
+std::string StatsReport::format(StatsFormat format) const {
+    // one row per stage, then the total
+    Summary  rows[sid2sng::STAGE_COUNT + 1];
+    uint64_t bytes = 0, patterns = 0, decoded = 0, repeats = 0;
+    for (int i = 0; i <= sid2sng::STAGE_COUNT; ++i) {
+        std::vector<uint64_t> v;
+        for (File const& f : m_files) v.push_back(i < sid2sng::STAGE_COUNT ? f.stats.ns[i] : f.total_ns);
+        rows[i] = summarize(std::move(v));
+    }
+    for (File const& f : m_files) {
+        bytes    += f.stats.bytes_scanned;
+        patterns += f.stats.patterns;
+        decoded  += f.stats.rows;
+        repeats  += f.stats.repeats;
+    }
+    std::vector<File const*> slowest;
+    for (File const& f : m_files) slowest.push_back(&f);
+    size_t n = std::min<size_t>(SLOWEST, slowest.size());
+    std::partial_sort(slowest.begin(), slowest.begin() + n, slowest.end(), [](File const* a, File const* b) {
+        return a->total_ns > b->total_ns;
+    });
+    slowest.resize(n);
+
+    std::string s;
+    if (format == STATS_JSON) {
+        appendf(s, "{\"files\":%d,\"cache_hits\":%d,\"stages\":{", (int) m_files.size(), m_cache_hits);
+        for (int i = 0; i <= sid2sng::STAGE_COUNT; ++i) {
+            Summary const& r = rows[i];
+            appendf(s, "%s\"%s\":{\"total_ms\":%.3f,\"mean_us\":%.3f,\"p50_us\":%.3f,\"p90_us\":%.3f,"
+                    "\"p99_us\":%.3f,\"max_us\":%.3f}", i ? "," : "",
+                    i < sid2sng::STAGE_COUNT ? STAGE_KEYS[i] : "total",
+                    r.sum / 1e6, r.mean / 1000, us(r.p50), us(r.p90), us(r.p99), us(r.max));
+        }
+        s += "},";
+        counters(s, bytes, patterns, decoded, repeats, format);
+        s += ",\"slowest\":[";
+        for (size_t i = 0; i < slowest.size(); ++i) {
+            s += i ? ",{\"file\":" : "{\"file\":";
+            s += json_string(slowest[i]->name);
+            appendf(s, ",\"us\":%.3f}", us(slowest[i]->total_ns));
+        }
+        s += "]}\n";
+        return s;
+    }
+    appendf(s, "%d files timed, %d cache hits\n", (int) m_files.size(), m_cache_hits);
+    appendf(s, " %-14s %10s %10s %10s %10s %10s %10s\n", "stage", "total ms", "mean us", "p50 us", "p90 us",
+            "p99 us", "max us");
+    for (int i = 0; i <= sid2sng::STAGE_COUNT; ++i) {
+        Summary const& r = rows[i];
+        appendf(s, " %-14s %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+                i < sid2sng::STAGE_COUNT ? sid2sng::stage_name(sid2sng::Stage(i)) : "total",
+                r.sum / 1e6, r.mean / 1000, us(r.p50), us(r.p90), us(r.p99), us(r.max));
+    }
+    counters(s, bytes, patterns, decoded, repeats, format);
+    if (!slowest.empty()) s += "slowest:\n";
+    for (File const* f : slowest) {
+        appendf(s, " %10.3f us  ", us(f->total_ns));
+        s += f->name + "\n";
+    }
+    return s;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "sid2sng.hpp"
+
+// -stats output of the command line tool, as a table or as JSON.
+enum StatsFormat {
+    STATS_TABLE,
+    STATS_JSON,
+};
+
+std::string format_stats(sid2sng::Stats const& stats, StatsFormat format);
+
+// Aggregates the stats of a batch into percentiles per stage and lists the
+// slowest files, to spot outliers. Cache hits are only counted.
+class StatsReport {
+public:
+    void        add(std::string const& name, sid2sng::Stats const& stats);
+    std::string format(StatsFormat format) const;
+
+private:
+    struct File {
+        std::string    name;
+        sid2sng::Stats stats;
+        uint64_t       total_ns;
+    };
+    std::vector<File> m_files;
+    int               m_cache_hits = 0;
+};
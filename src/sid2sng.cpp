@@ -0,0 +1,117 @@
+#include "sid2sng.hpp"
+#include <memory>
+#include "compactsong.hpp"
+#include "sid2song.hpp"
+#include "threadpool.hpp"
+
+
+char const* sid2sng::error_string(Error error) {
+    switch (error) {
+    case ERR_NONE:          return "no error";
+    case ERR_OPEN:          return "could not open file";
+    case ERR_HEADER:        return "bad sid header";
+    case ERR_NO_FREQ_TABLE: return "no freq table";
+    case ERR_TRUNCATED:     return "read past end of data";
+    case ERR_ORDER_LIST:    return "bad order list";
+    case ERR_PATTERN:       return "bad pattern";
+    case ERR_TABLE:         return "bad table";
+    case ERR_WRITE:         return "could not write file";
+    }
+    return "unknown error";
+}
+
+char const* sid2sng::stage_name(Stage stage) {
+    switch (stage) {
+    case STAGE_LOAD:         return "header load";
+    case STAGE_FREQ_TABLE:   return "anchor search";
+    case STAGE_AUTODETECT:   return "autodetect";
+    case STAGE_ORDER_LISTS:  return "order lists";
+    case STAGE_PATTERNS:     return "patterns";
+    case STAGE_INSTRUMENTS:  return "instr/tables";
+    case STAGE_OPTIMIZE:     return "optimize";
+    case STAGE_SAVE:         return "save";
+    case STAGE_COUNT:        break;
+    }
+    return "unknown stage";
+}
+
+
+sid2sng::Result sid2sng::convert(ByteSpan sid, Options const& options, gt::Song& song) {
+    Sid2Song convert(song, options);
+    convert.convert(sid);
+    return convert.result();
+}
+
+sid2sng::Result sid2sng::convert(ByteSpan sid, Options const& options, std::vector<uint8_t>& sng) {
+    // the song is too big for small thread stacks
+    auto song = std::make_unique<gt::Song>();
+    return convert(sid, options, *song, sng);
+}
+
+sid2sng::Result sid2sng::convert(ByteSpan sid, Options const& options, gt::Song& song, std::vector<uint8_t>& sng) {
+    Sid2Song convert(song, options);
+    convert.convert(sid, sng);
+    return convert.result();
+}
+
+sid2sng::Probe sid2sng::probe(ByteSpan sid, Options const& options) {
+    Sid2Song convert(options);
+    Probe    probe;
+    convert.probe(sid, probe);
+    return probe;
+}
+
+sid2sng::Result sid2sng::convert_file(char const* sid_filename, char const* sng_filename, Options const& options) {
+    auto     song = std::make_unique<gt::Song>();
+    Sid2Song convert(*song, options);
+    std::vector<uint8_t> sng;
+    convert.run(sid_filename, sng_filename, sng);
+    return convert.result();
+}
+
+
+sid2sng::Converter::Converter(Options const& options)
+    : m_options(options)
+    , m_song(std::make_unique<gt::Song>())
+{
+    if ((options.search || options.emulate) && options.search_threads > 1) {
+        m_search_pool = std::make_unique<ThreadPool>(options.search_threads);
+    }
+}
+
+sid2sng::Converter::Converter(Converter&&) = default;
+sid2sng::Converter::~Converter() = default;
+
+void sid2sng::Converter::prepare(Sid2Song& convert) {
+    convert.m_dirty_patterns = m_dirty_patterns;
+    convert.m_search_pool    = m_search_pool.get();
+    // the log writes into the buffer of the last result
+    m_result.log.clear();
+    convert.m_log.swap(m_result.log);
+    m_sng.clear();
+}
+
+sid2sng::Result const& sid2sng::Converter::convert(ByteSpan sid) {
+    Sid2Song convert(*m_song, m_options);
+    prepare(convert);
+    if (!convert.convert(sid, m_sng)) m_sng.clear();
+    convert.result(m_result);
+    m_dirty_patterns = convert.m_dirty_patterns;
+    return m_result;
+}
+
+sid2sng::Result const& sid2sng::Converter::convert(ByteSpan sid, gt::CompactSong& song) {
+    convert(sid);
+    // saved images always index
+    if (m_result.ok()) song.load(m_sng.data(), m_sng.size());
+    return m_result;
+}
+
+sid2sng::Result const& sid2sng::Converter::convert_file(char const* sid_filename, char const* sng_filename) {
+    Sid2Song convert(*m_song, m_options);
+    prepare(convert);
+    if (!convert.run(sid_filename, sng_filename, m_sng)) m_sng.clear();
+    convert.result(m_result);
+    m_dirty_patterns = convert.m_dirty_patterns;
+    return m_result;
+}
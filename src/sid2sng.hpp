@@ -0,0 +1,173 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "gsong.hpp"
+#include "log.hpp"
+#include "mapfile.hpp"
+
+class ConvertCache;
+class DetectCache;
+class Sid2Song;
+class ThreadPool;
+namespace gt { class CompactSong; }
+
+// Public interface of libsid2sng. The conversion functions are reentrant:
+// concurrent calls share nothing except the optional DetectCache and
+// ConvertCache, which are thread-safe. Nothing is printed, messages are
+// returned in Result::log.
+namespace sid2sng {
+
+// Revision of the converter output, part of the conversion cache key. Bump
+// it with every change that gives a different song, features, warnings or
+// log text for the same sid and options, down to the wording of a message,
+// so cached conversions are not reused. Stats are not cached.
+enum { VERSION = 3 };
+
+// disabled player features
+enum Feature : uint32_t {
+    NOPULSE     = 1,
+    NOFILTER    = 2,
+    NOINSTRVIB  = 4,
+    FIXEDPARAMS = 8,
+    NOWAVEDELAY = 16,
+    FEATURE_COMBOS = 32,
+};
+
+enum Error {
+    ERR_NONE,
+    ERR_OPEN,           // could not open the sid file
+    ERR_HEADER,         // bad sid header or song count
+    ERR_NO_FREQ_TABLE,  // not a GoatTracker2 sid
+    ERR_TRUNCATED,      // read past end of data
+    ERR_ORDER_LIST,
+    ERR_PATTERN,
+    ERR_TABLE,
+    ERR_WRITE,          // could not write the sng file
+};
+
+enum Warning : uint32_t {
+    WARN_TABLES_PAST_ORDER_LIST = 1,    // tables overlap the first order list
+    WARN_TABLE_DATA_LEFT        = 2,    // gap between tables and order lists
+    WARN_EMULATION              = 4,    // player code didn't run, -emulate was ignored
+};
+
+// stages of a conversion, in order
+enum Stage {
+    STAGE_LOAD,         // sid header
+    STAGE_FREQ_TABLE,   // anchor search
+    STAGE_AUTODETECT,
+    STAGE_ORDER_LISTS,
+    STAGE_PATTERNS,
+    STAGE_INSTRUMENTS,  // instruments and tables, or the feature search
+    STAGE_OPTIMIZE,
+    STAGE_SAVE,         // building the GTS5 image
+    STAGE_COUNT,
+};
+
+struct Stats {
+    uint64_t ns[STAGE_COUNT]  = {};     // only measured with Options::stats
+    uint32_t bytes_scanned    = 0;      // searched for the freq table and signatures
+    uint32_t patterns         = 0;
+    uint32_t rows             = 0;      // pattern rows decoded
+    uint32_t repeats          = 0;      // packed rows that expand to several
+    bool     cache_hit        = false;  // nothing was converted
+};
+
+struct Options {
+    uint32_t     features       = 0;    // disabled features, unless detected
+    bool         autodetect     = true;
+    // If instruments and tables don't decode consistently with the features,
+    // try all combinations and keep the best, using up to search_threads.
+    bool         search         = false;
+    int          search_threads = 1;
+    // Implies search. Runs the player on a 6502 core to see where it reads
+    // instrument columns and tables; if the detected features don't decode
+    // cleanly, the clean combination that matches the most wins.
+    bool         emulate        = false;
+    // merge duplicate patterns, fold repeated patterns in the order lists
+    // and drop unused patterns and instruments; playback stays the same
+    bool         optimize       = false;
+    LogLevel     log_level      = LOG_ERROR;
+    bool         stats          = false;    // time the stages in Result::stats
+    DetectCache* detect_cache   = nullptr;
+    // Finished conversions are looked up here first. Only the functions that
+    // produce GTS5 bytes use it.
+    ConvertCache* convert_cache = nullptr;
+};
+
+struct Result {
+    Error       error    = ERR_NONE;
+    uint32_t    features = 0;           // disabled features used for decoding
+    uint32_t    warnings = 0;           // Warning bits
+    std::string log;                    // messages up to Options::log_level
+    Stats       stats;
+
+    bool ok() const { return error == ERR_NONE; }
+};
+
+// What a quick look at a sid shows, without decoding the song.
+struct Probe {
+    Error    error       = ERR_NONE;    // ERR_NO_FREQ_TABLE if it's not a GoatTracker2 sid
+    int      channels    = 0;
+    int      songs       = 0;
+    uint32_t features    = 0;           // disabled features, auto-detected unless turned off
+    uint32_t anchor      = 0;           // file offset behind the freq table, where the song data starts
+    uint64_t player_hash = 0;           // DetectCache::hash of the player code
+
+    bool ok() const { return error == ERR_NONE; }
+};
+
+char const* error_string(Error error);
+char const* stage_name(Stage stage);
+
+Result convert(ByteSpan sid, Options const& options, gt::Song& song);
+// sng receives the GTS5 image
+Result convert(ByteSpan sid, Options const& options, std::vector<uint8_t>& sng);
+// same, with the caller's song as scratch space; it is left alone on a cache hit
+Result convert(ByteSpan sid, Options const& options, gt::Song& song, std::vector<uint8_t>& sng);
+// checks the header, finds the freq table and auto-detects the features
+Probe  probe(ByteSpan sid, Options const& options);
+// a sng_filename of "-" writes the song to stdout
+Result convert_file(char const* sid_filename, char const* sng_filename, Options const& options);
+
+// Converts one sid after another with the same options, for workers that
+// convert many. The song, the GTS5 buffer and the result are kept between
+// conversions, and the song is only reset where the last one wrote to it, so
+// once the buffers have grown a conversion allocates nothing. Search,
+// emulation and the convert cache still do, and so does a DetectCache for
+// players it hasn't seen. With search_threads above 1, the search runs on a
+// thread pool of the converter. One per thread.
+class Converter {
+public:
+    explicit Converter(Options const& options);
+    Converter(Converter&&);
+    ~Converter();
+
+    // the result stays valid until the next conversion
+    Result const& convert(ByteSpan sid);
+    Result const& convert_file(char const* sid_filename, char const* sng_filename);
+    // Converts into a song that only keeps what the sid uses, e.g. to hold
+    // many of them. The song is left alone if the conversion fails.
+    Result const& convert(ByteSpan sid, gt::CompactSong& song);
+
+    // the GTS5 image of the last successful convert()
+    ByteSpan        sng() const { return ByteSpan(m_sng.data(), m_sng.size()); }
+    // the song of the last conversion that ran; a convert cache hit leaves it
+    // alone, so it may hold an earlier sid then
+    gt::Song const& song() const { return *m_song; }
+
+private:
+    void prepare(Sid2Song& convert);
+
+    Options                   m_options;
+    // the song is too big for small thread stacks
+    std::unique_ptr<gt::Song> m_song;
+    std::vector<uint8_t>      m_sng;
+    Result                    m_result;
+    int                       m_dirty_patterns = gt::MAX_PATT;   // see Sid2Song
+    std::unique_ptr<ThreadPool> m_search_pool;
+};
+
+} // namespace sid2sng
@@ -0,0 +1,925 @@
+#include "sid2song.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include "cpu6502.hpp"
+#include "memsearch.hpp"
+#include "packedpattern.hpp"
+#include "sigscan.hpp"
+#include "songopt.hpp"
+#include "threadpool.hpp"
+
+
+Sid2Song::Sid2Song(gt::Song& song, sid2sng::Options const& options)
+    : Sid2Song(options)
+{
+    m_song = &song;
+}
+
+Sid2Song::Sid2Song(sid2sng::Options const& options)
+    : m_nopulse(options.features & sid2sng::NOPULSE)
+    , m_nofilter(options.features & sid2sng::NOFILTER)
+    , m_noinstrvib(options.features & sid2sng::NOINSTRVIB)
+    , m_fixedparams(options.features & sid2sng::FIXEDPARAMS)
+    , m_nowavedelay(options.features & sid2sng::NOWAVEDELAY)
+    , m_autodetect(options.autodetect)
+    , m_search(options.search || options.emulate)
+    , m_emulate(options.emulate)
+    , m_optimize(options.optimize)
+    , m_timing(options.stats)
+    , m_search_threads(options.search_threads)
+    , m_detect_cache(options.detect_cache)
+    , m_convert_cache(options.convert_cache)
+    , m_log(options.log_level)
+{
+    m_cache_salt = options.features
+                 | m_autodetect << 8
+                 | m_search << 9
+                 | m_emulate << 10
+                 | m_optimize << 11
+                 | options.log_level << 12
+                 | uint64_t(sid2sng::VERSION) << 32;
+}
+
+uint32_t Sid2Song::features() const {
+    return m_nopulse     * sid2sng::NOPULSE
+         | m_nofilter    * sid2sng::NOFILTER
+         | m_noinstrvib  * sid2sng::NOINSTRVIB
+         | m_fixedparams * sid2sng::FIXEDPARAMS
+         | m_nowavedelay * sid2sng::NOWAVEDELAY;
+}
+
+void Sid2Song::set_features(uint32_t features) {
+    m_nopulse     = features & sid2sng::NOPULSE;
+    m_nofilter    = features & sid2sng::NOFILTER;
+    m_noinstrvib  = features & sid2sng::NOINSTRVIB;
+    m_fixedparams = features & sid2sng::FIXEDPARAMS;
+    m_nowavedelay = features & sid2sng::NOWAVEDELAY;
+}
+
+sid2sng::Result Sid2Song::result() {
+    sid2sng::Result res;
+    result(res);
+    return res;
+}
+
+void Sid2Song::result(sid2sng::Result& res) {
+    res.error    = m_error;
+    res.features = features();
+    res.warnings = m_warnings;
+    res.log.clear();
+    m_log.swap(res.log);
+    res.stats    = m_stats;
+}
+
+
+void Sid2Song::message(char const* prefix, char const* fmt, va_list args) {
+    m_log.print(LOG_ERROR, "%s", prefix);
+    m_log.vprint(LOG_ERROR, fmt, args);
+    m_log.print(LOG_ERROR, "\n");
+}
+
+bool Sid2Song::error(sid2sng::Error code, char const* fmt, ...) {
+    // keep the first error, later ones are usually follow-ups
+    if (m_error == sid2sng::ERR_NONE) m_error = code;
+    va_list args;
+    va_start(args, fmt);
+    message("ERROR: ", fmt, args);
+    va_end(args);
+    return false;
+}
+
+void Sid2Song::warning(sid2sng::Warning code, char const* fmt, ...) {
+    m_warnings |= code;
+    va_list args;
+    va_start(args, fmt);
+    message("WARNING: ", fmt, args);
+    va_end(args);
+}
+
+
+bool Sid2Song::read_header(ByteSpan data) {
+    m_data      = data;
+    m_in        = Cursor(data);
+    m_truncated = false;
+    m_error     = sid2sng::ERR_NONE;
+    m_warnings  = 0;
+    m_stats     = sid2sng::Stats();
+    if (!parse_sid_header(m_data, m_info)) return error(sid2sng::ERR_HEADER, "bad sid header");
+    return true;
+}
+
+
+bool Sid2Song::load_sid(ByteSpan data) {
+    if (!read_header(data)) return false;
+
+    SidInfo const& h = m_info;
+    m_log.print(LOG_SUMMARY, "SID\n");
+    m_log.print(LOG_SUMMARY, " magic:       %.4s\n", h.magic);
+    m_log.print(LOG_SUMMARY, " version:     %d\n", h.version);
+    m_log.print(LOG_SUMMARY, " offset:      %04X\n", h.offset);
+    m_log.print(LOG_SUMMARY, " load addr:   %04X\n", h.load_addr);
+    m_log.print(LOG_SUMMARY, " init addr:   %04X\n", h.init_addr);
+    m_log.print(LOG_SUMMARY, " play addr:   %04X\n", h.play_addr);
+    m_log.print(LOG_SUMMARY, " song count:  %d\n", h.song_count);
+    m_log.print(LOG_SUMMARY, " start song:  %d\n", h.start_song);
+    m_log.print(LOG_SUMMARY, " speed:       %08X\n", h.speed);
+    m_log.print(LOG_SUMMARY, " song name:   %.32s\n", h.song_name);
+    m_log.print(LOG_SUMMARY, " song author: %.32s\n", h.song_author);
+    m_log.print(LOG_SUMMARY, " copyright:   %.32s\n", h.song_released);
+    if (h.version > 1) {
+        m_log.print(LOG_SUMMARY, " flags:       %04X\n", h.flags);
+        m_log.print(LOG_SUMMARY, " start page:  %02X\n", h.start_page);
+        m_log.print(LOG_SUMMARY, " page length: %02X\n", h.page_length);
+        m_log.print(LOG_SUMMARY, " sid 2 addr:  %02X\n", h.sid_addr_2);
+        m_log.print(LOG_SUMMARY, " sid 3 addr:  %02X\n", h.sid_addr_3);
+    }
+
+    if (m_dirty_patterns < gt::MAX_PATT) m_song->reset(m_dirty_patterns);
+    else m_song->clear();
+    m_dirty_patterns = 0;
+    memcpy(m_song->songname, h.song_name, sizeof(h.song_name));
+    memcpy(m_song->authorname, h.song_author, sizeof(h.song_author));
+    memcpy(m_song->copyrightname, h.song_released, sizeof(h.song_released));
+
+    m_song_count  = h.song_count;
+    if (m_song_count < 1 || m_song_count > gt::MAX_SONGS) return error(sid2sng::ERR_HEADER, "bad song count");
+    m_addr_offset = h.offset - h.load_addr + 2;
+    m_song->channels = h.channels();
+
+    return true;
+}
+
+
+void Sid2Song::autodetect_options() {
+    // Auto-detecting disabled player features works by searching for unique
+    // code snippets in the player, i.e. everything before the freq table.
+    // Only instruction opcodes and const immediate values are used in the
+    // comparison, the dots (.) match any byte. All signatures are compiled at
+    // compile time and matched in a single pass over the player.
+    // The code snippets have been veried for player versions 2.63 and 2.73.
+
+    // v2.73 or similar
+    // mt_skipwave2:
+    // .C:11d8  FE B1 13    INC $13B1,X	    alt: lda #$ff; sta addr,x
+    // mt_skipwave:
+    // .C:11db  B9 01 15    LDA $1501,Y     /- .IF (NOPULSE == 0)
+    // .C:11de  F0 08       BEQ $11E8       |
+    // .C:11e0  9D 9B 13    STA $139B,X     |
+    //                                      |   /- .IF (NOPULSEMOD == 0)
+    //                                      |   \-
+    // mt_skippulse:                        \-
+    //
+    // v2.63 or similar
+    // .C:0a46  9D CF 0C    STA $0CCF,X     alt: sta zp,x
+    // .C:0a49  B9 41 0F    LDA $0F41,Y     /- .IF (NOPULSE == 0)
+    // .C:0a4c  F0 08       BEQ $0A56       |
+    // .C:0a4e  9D 94 0C    STA $0C94,X     |
+    static constexpr sig::Signature PULSE = sig::compile(R"((\x95.|\x9d..|\xfe..)\xb9..\xf0.\x9d)");
+
+    // mt_filtstep:
+    // .C:1101  A0 00       LDY #$00        /- .IF (NOFILTER == 0)
+    // .C:1103  F0 45       BEQ $114A       |
+    // mt_filttime:                         |
+    // .C:1105  A9 00       LDA #$00	    |   /- .IF (NOFILTERMOD == 0)
+    // .C:1107  D0 23       BNE $112C	    |   \-
+    // mt_newfiltstep:                      |
+    // .C:1109  B9 FB 15    LDA $15FB,Y     |
+    // .C:110c  F0 12       BEQ $1120       \-
+    static constexpr sig::Signature FILTER = sig::compile(R"(\xa0.\xf0.(\xa9.\xd0.)?\xb9..\xf0)");
+
+    // mt_effect_0_delay:                   /- .IF (NOINSTRVIB == 0)
+    // .C:1044  DE C1 13    DEC $13C1,X     |
+    // mt_effect_0_donothing:               |
+    // .C:1047  4C 7D 12    JMP $127D       |
+    // mt_effect_0:                         |
+    // .C:104a  F0 FB       BEQ $1047       |
+    // .C:104c  BD C1 13    LDA $13C1,X     |
+    // .C:104f  D0 F3       BNE $1044       \-
+    static constexpr sig::Signature INSTRVIB = sig::compile(R"(\xde..\x4c..\xf0.\xbd..\xd0)");
+
+    // mt_nonewpatt:
+    // .C:11aa  BC B0 13    LDY $13B0,X
+    //          B9 .. ..    lda addr,y      /- (FIXEDPARAMS == 0)
+    //          9D .. ..    sta addr,x      \-
+    // .C:11ad  BD 98 13    LDA $1398,X
+    // .C:11b0  F0 5E       BEQ $1210
+    // mt_newnoteinit:
+    // .C:11b2  38          SEC
+    // .C:11b3  E9 60       SBC #$60
+    static constexpr sig::Signature PARAMS = sig::compile(R"(\xbc..\xb9..\x9d..\xbd..\xf0.\x38\xe9)");
+
+    // mt_waveexec:
+    // ...
+    // .C:121e  C9 10       CMP #$10	    /- .IF (NOWAVEDELAY == 0)
+    // .C:1220  B0 0A       BCS $122C       |
+    // .C:1222  DD C2 13    CMP $13C2,X     |
+    // .C:1225  F0 0A       BEQ $1231       |
+    static constexpr sig::Signature WAVEDELAY = sig::compile(R"(\xc9\x10\xb0.\xdd..\xf0)");
+
+    static constexpr sig::Scanner<5> scanner({ PULSE, FILTER, INSTRVIB, PARAMS, WAVEDELAY });
+    static_assert(scanner.valid(), "invalid player signature");
+
+    // the result only depends on the player code, so it can be cached
+    uint32_t found;
+    uint64_t key = m_player_hash = DetectCache::hash(m_player);
+    if (m_detect_cache && m_detect_cache->lookup(key, found)) {
+        m_detect_hit_pos = m_log.buffer().size();
+        m_log.print(LOG_SUMMARY, "auto-detect cache hit %016llx\n", (unsigned long long) key);
+        m_detect_hit_len = m_log.buffer().size() - m_detect_hit_pos;
+    }
+    else {
+        found = scanner.scan(m_player.data(), m_player.size());
+        m_stats.bytes_scanned += m_player.size();
+        if (m_detect_cache) m_detect_cache->insert(key, found);
+    }
+
+    m_nopulse     = not (found & 1);
+    m_nofilter    = not (found & 2);
+    m_noinstrvib  = not (found & 4);
+    m_fixedparams = not (found & 8);
+    m_nowavedelay = not (found & 16);
+    m_log.print(LOG_SUMMARY, "auto-detect nopulse = %d\n", m_nopulse);
+    m_log.print(LOG_SUMMARY, "auto-detect nofilter = %d\n", m_nofilter);
+    m_log.print(LOG_SUMMARY, "auto-detect noinstrvib = %d\n", m_noinstrvib);
+    m_log.print(LOG_SUMMARY, "auto-detect fixedparams = %d\n", m_fixedparams);
+    m_log.print(LOG_SUMMARY, "auto-detect nowavedelay = %d\n", m_nowavedelay);
+}
+
+
+void Sid2Song::dump_order_lists(int song) {
+    m_log.print(LOG_VERBOSE, "SONG %d\n", song);
+    for (int c = 0; c < m_song->channels; ++c) {
+        uint8_t const* order = m_song->songorder[song][c];
+        m_log.print(LOG_VERBOSE, " %d:", c);
+        int p = 0;
+        for (; order[p] != gt::LOOPSONG; ++p) {
+            int x = order[p];
+            if (x < gt::REPEAT) {
+                m_log.print(LOG_VERBOSE, " %02X", x);
+            }
+            else if (x < gt::TRANSDOWN) {
+                // print in packed order, i.e. after the pattern index
+                m_log.print(LOG_VERBOSE, " %02X R%X", order[++p], x - gt::REPEAT + 1);
+            }
+            else {
+                int q = x - gt::TRANSUP;
+                m_log.print(LOG_VERBOSE, " %c%X", "+-"[q < 0], abs(q));
+            }
+        }
+        m_log.print(LOG_VERBOSE, " RST%02X\n", order[p + 1]);
+    }
+}
+
+void Sid2Song::dump_pattern(int patt) {
+    m_log.print(LOG_VERBOSE, "PATTERN %02X\n", patt);
+    uint8_t const* row = m_song->pattern[patt];
+    for (int r = 0; row[0] != gt::ENDPATT; ++r, row += 4) {
+        int note = row[0];
+        m_log.print(LOG_VERBOSE, " %02X: ", r);
+        if      (note == gt::REST)   m_log.print(LOG_VERBOSE, "...");
+        else if (note == gt::KEYOFF) m_log.print(LOG_VERBOSE, "===");
+        else if (note == gt::KEYON)  m_log.print(LOG_VERBOSE, "+++");
+        else m_log.print(LOG_VERBOSE, "%c%c%d",
+                         "CCDDEFFGGAAB"[note % 12],
+                         "-#-#--#-#-#-"[note % 12],
+                         (note - gt::FIRSTNOTE) / 12);
+        m_log.print(LOG_VERBOSE, " %02X%X%02X\n", row[1], row[2], row[3]);
+    }
+}
+
+void Sid2Song::dump_instruments(int count) {
+    m_log.print(LOG_VERBOSE, "INSTR\n");
+    for (int i = 1; i <= count; ++i) {
+        auto const& instr = m_song->instr[i];
+        m_log.print(LOG_VERBOSE, " %02x: %02x %02x %02x %02x %02x %02x %02x %02x %02x\n", i,
+                    instr.ad, instr.sr, instr.ptr[0], instr.ptr[1], instr.ptr[2], instr.ptr[3],
+                    instr.vibdelay, instr.gatetimer, instr.firstwave);
+    }
+}
+
+void Sid2Song::dump_table(int t, int len) {
+    for (int i = 0; i < len; ++i) {
+        m_log.print(LOG_VERBOSE, " %02X: %02X %02X\n", i + 1, m_song->ltable[t][i], m_song->rtable[t][i]);
+    }
+}
+
+
+bool Sid2Song::run(char const* sid_filename, char const* sng_filename, std::vector<uint8_t>& sng) {
+    MappedFile file;
+    if (!file.open(sid_filename)) return error(sid2sng::ERR_OPEN, "could not open file");
+    if (!convert(file.span(), sng)) return false;
+
+    if (strcmp(sng_filename, "-") == 0) {
+        if (fwrite(sng.data(), 1, sng.size(), stdout) != sng.size()) {
+            return error(sid2sng::ERR_WRITE, "could not write to stdout");
+        }
+    }
+    else {
+        FILE* out = fopen(sng_filename, "wb");
+        bool  ok  = out && fwrite(sng.data(), 1, sng.size(), out) == sng.size();
+        if (out) ok = fclose(out) == 0 && ok;
+        if (!ok) return error(sid2sng::ERR_WRITE, "could not write %s", sng_filename);
+    }
+    return true;
+}
+
+
+bool Sid2Song::convert(ByteSpan data, std::vector<uint8_t>& sng) {
+    uint64_t key = 0;
+    if (m_convert_cache) {
+        key = ConvertCache::key(data, m_cache_salt);
+        ConvertCache::Entry entry;
+        if (m_convert_cache->lookup(key, data, entry)) {
+            set_features(entry.features);
+            m_warnings = entry.warnings;
+            m_stats.cache_hit = true;
+            m_log.append(entry.log);
+            sng.swap(entry.sng);
+            return true;
+        }
+    }
+    if (!convert(data)) return false;
+    m_song->save(sng);
+    lap(sid2sng::STAGE_SAVE);
+    // only successful conversions are stored, failures are cheap
+    if (m_convert_cache) {
+        std::string log = m_log.buffer();
+        log.erase(m_detect_hit_pos, m_detect_hit_len);
+        m_convert_cache->insert(key, data, features(), m_warnings, log, ByteSpan(sng.data(), sng.size()));
+    }
+    return true;
+}
+
+
+bool Sid2Song::probe(ByteSpan data, sid2sng::Probe& probe) {
+    probe = sid2sng::Probe();
+    if (read_header(data)) {
+        probe.channels = m_info.channels();
+        probe.songs    = m_info.song_count;
+        if (m_info.song_count < 1 || m_info.song_count > gt::MAX_SONGS) {
+            error(sid2sng::ERR_HEADER, "bad song count");
+        }
+        else if (find_freq_table()) {
+            probe.anchor = m_in.pos();
+            if (m_autodetect) autodetect_options();
+            probe.player_hash = m_autodetect ? m_player_hash : DetectCache::hash(m_player);
+            probe.features    = features();
+        }
+    }
+    probe.error = m_error;
+    return probe.ok();
+}
+
+
+bool Sid2Song::convert(ByteSpan data) {
+    if (m_timing) m_lap = std::chrono::steady_clock::now();
+    if (!load_sid(data)) return false;
+    lap(sid2sng::STAGE_LOAD);
+    if (!find_freq_table()) return false;
+    lap(sid2sng::STAGE_FREQ_TABLE);
+    if (m_autodetect) autodetect_options();
+    lap(sid2sng::STAGE_AUTODETECT);
+    if (!decode_order_lists()) return false;
+    lap(sid2sng::STAGE_ORDER_LISTS);
+    if (!decode_patterns()) return false;
+    lap(sid2sng::STAGE_PATTERNS);
+    if (m_search) {
+        if (!search_features()) return false;
+    }
+    else {
+        if (!decode_instruments()) return false;
+        if (!decode_tables()) return false;
+    }
+    lap(sid2sng::STAGE_INSTRUMENTS);
+    // an error that didn't stop its stage still fails the conversion
+    if (m_error != sid2sng::ERR_NONE) return false;
+
+    // sanity check
+    int pos = m_in.pos();
+    if (pos > m_song_order_list_pos[0]) {
+        warning(sid2sng::WARN_TABLES_PAST_ORDER_LIST, "read tables past order list (%d > %d)", pos, m_song_order_list_pos[0]);
+    }
+    if (pos < m_song_order_list_pos[0]) {
+        warning(sid2sng::WARN_TABLE_DATA_LEFT, "not all table data was read (%d < %d)", pos, m_song_order_list_pos[0]);
+    }
+
+    if (m_optimize) {
+        gt::OptimizeStats st = gt::optimize(*m_song);
+        // unplayed slots up to the highest used pattern get cut to one row
+        m_dirty_patterns = std::max(m_dirty_patterns, m_song->highestusedpattern + 1);
+        m_log.print(LOG_SUMMARY, "optimize: %d duplicate patterns, %d unused patterns, %d unused instruments, "
+                    "%d order list bytes folded\n", st.merged_patterns, st.dropped_patterns,
+                    st.dropped_instruments, st.folded_orders);
+        lap(sid2sng::STAGE_OPTIMIZE);
+    }
+    return true;
+}
+
+
+bool Sid2Song::find_freq_table() {
+    // find end of freq table
+    uint8_t const FREQ_HI[] = "\x08\x09\x09\x0a\x0a\x0b\x0c\x0d\x0d\x0e\x0f\x10\x11\x12\x13\x14"
+                              "\x15\x17\x18\x1a\x1b\x1d\x1f\x20\x22\x24\x27\x29\x2b\x2e\x31\x34"
+                              "\x37\x3a\x3e\x41\x45\x49\x4e\x52\x57\x5c\x62\x68\x6e\x75\x7c\x83"
+                              "\x8b\x93\x9c\xa5\xaf\xb9\xc4\xd0\xdd\xea\xf8\xff";
+    uint8_t const* hi = find_mem(m_data.data(), m_data.size(), FREQ_HI, 12);
+    if (!hi) return error(sid2sng::ERR_NO_FREQ_TABLE, "no freq table");
+    int player_pos = std::min<int>(m_info.offset + 2, hi - m_data.data());
+    m_player = m_data.subspan(player_pos, hi - m_data.data() - player_pos);
+    uint8_t const* end = m_data.data() + m_data.size();
+    for (int i = 0; FREQ_HI[i] && hi < end && *hi == FREQ_HI[i]; ++i) ++hi;
+    m_in.seek(hi - m_data.data());
+    m_stats.bytes_scanned += m_in.pos();
+    return true;
+}
+
+
+bool Sid2Song::decode_order_lists() {
+    // song table, low bytes of all order lists, then high bytes
+    if (!need(m_song_count * m_song->channels * 2)) return false;
+    for (int i = 0; i < m_song_count; ++i) {
+        m_song_order_list_pos[i] = m_in.next();
+        m_in.skip(m_song->channels - 1);
+    }
+    for (int i = 0; i < m_song_count; ++i) {
+        m_song_order_list_pos[i] |= m_in.next() << 8;
+        m_song_order_list_pos[i] += m_addr_offset;
+        m_in.skip(m_song->channels - 1);
+    }
+
+    m_patt_table_pos = m_in.pos();
+
+    // song order list
+    m_patt_count = 0;
+    for (int i = 0; i < m_song_count; ++i) {
+        m_in.seek(m_song_order_list_pos[i]);
+
+        for (int c = 0; c < m_song->channels; ++c) {
+            int p = 0;
+            for (;;) {
+                int x = read();
+                if (m_truncated) return false;
+                if (x == gt::LOOPSONG) break;
+                if (p >= gt::MAX_SONGLEN) return error(sid2sng::ERR_ORDER_LIST, "order list too long");
+                if (x < gt::REPEAT) {
+                    m_song->songorder[i][c][p++] = x;
+                    m_patt_count = std::max(x + 1, m_patt_count);
+                }
+                else if (x < gt::TRANSDOWN) {
+                    // repeat
+                    if (p == 0) return error(sid2sng::ERR_ORDER_LIST, "repeat without pattern");
+                    // swap with previous byte (i.e., pattern index)
+                    m_song->songorder[i][c][p    ] = m_song->songorder[i][c][p - 1];
+                    m_song->songorder[i][c][p - 1] = x;
+                    ++p;
+                }
+                else {
+                    // transpose
+                    m_song->songorder[i][c][p++] = x;
+                }
+            }
+            // pattern end
+            int x = read();
+            m_song->songorder[i][c][p++] = 0xff;
+            m_song->songorder[i][c][p++] = x;
+        }
+        if (m_log.enabled(LOG_VERBOSE)) dump_order_lists(i);
+    }
+    return true;
+}
+
+
+bool Sid2Song::decode_patterns() {
+    gt::UnpackState state;
+    for (int i = 0, pos = m_in.pos(); pos < (int) m_data.size(); i++) {
+        if (i >= gt::MAX_PATT) return error(sid2sng::ERR_PATTERN, "too many patterns");
+        m_dirty_patterns = i + 1;
+
+        int rows;
+        gt::UnpackResult res = gt::unpack_pattern(m_data.data(), m_data.size(), pos, m_song->pattern[i], rows, state);
+        m_in.seek(pos);
+        m_stats.repeats += state.repeats;
+        state.repeats = 0;
+        if (state.truncated) truncated();
+        if (res == gt::UNPACK_TRUNCATED) return false;
+        if (res == gt::UNPACK_TOO_MANY_ROWS) return error(sid2sng::ERR_PATTERN, "too many pattern rows");
+        m_stats.rows += rows;
+        ++m_stats.patterns;
+        if (m_log.enabled(LOG_VERBOSE)) dump_pattern(i);
+    }
+    m_instr_count = state.instr_count;
+    std::copy(state.max_table, state.max_table + gt::MAX_TABLES, m_max_table);
+    return true;
+}
+
+
+// The instruments and tables are decoded by one instantiation per feature
+// combination, picked once per call. The flags are constants in there, so
+// the columns and fixups are read without branching on them.
+template <size_t... F>
+bool Sid2Song::decode_instruments(std::index_sequence<F...>) {
+    // the instruments don't depend on the wave delay
+    static constexpr bool (Sid2Song::*decoders[])() = {
+        &Sid2Song::decode_instruments_as<F & ~sid2sng::NOWAVEDELAY>...
+    };
+    return (this->*decoders[features()])();
+}
+
+template <size_t... F>
+bool Sid2Song::decode_tables(std::index_sequence<F...>) {
+    static constexpr bool (Sid2Song::*decoders[])() = { &Sid2Song::decode_tables_as<F>... };
+    return (this->*decoders[features()])();
+}
+
+bool Sid2Song::decode_instruments() {
+    return decode_instruments(std::make_index_sequence<sid2sng::FEATURE_COMBOS>());
+}
+
+bool Sid2Song::decode_tables() {
+    return decode_tables(std::make_index_sequence<sid2sng::FEATURE_COMBOS>());
+}
+
+
+template <uint32_t F>
+bool Sid2Song::decode_instruments_as() {
+    constexpr bool NOPULSE     = F & sid2sng::NOPULSE;
+    constexpr bool NOFILTER    = F & sid2sng::NOFILTER;
+    constexpr bool NOINSTRVIB  = F & sid2sng::NOINSTRVIB;
+    constexpr bool FIXEDPARAMS = F & sid2sng::FIXEDPARAMS;
+
+    int  instr_count = m_instr_count;
+    int* max_table   = m_max_table;
+    gt::Instr* instr = m_song->instr;
+    if (cancelled()) return false;
+
+    // skip pattern table
+    m_in.seek(m_patt_table_pos + m_patt_count * 2);
+    m_section_count = 0;
+
+    // all columns are checked at once
+    constexpr int COLUMNS = 3 + !NOPULSE + !NOFILTER + 2 * !NOINSTRVIB + 2 * !FIXEDPARAMS;
+    if (!need(COLUMNS * instr_count)) return false;
+
+    auto ptr_column = [&](int t) {
+        section();
+        for (int i = 1; i <= instr_count; ++i) {
+            int x = m_in.next();
+            max_table[t] = std::max(max_table[t], x);
+            instr[i].ptr[t] = x;
+        }
+    };
+
+    section();
+    for (int i = 1; i <= instr_count; ++i) instr[i].ad = m_in.next();
+    section();
+    for (int i = 1; i <= instr_count; ++i) instr[i].sr = m_in.next();
+    ptr_column(gt::WTBL);
+    if constexpr (!NOPULSE) ptr_column(gt::PTBL);
+    if constexpr (!NOFILTER) ptr_column(gt::FTBL);
+    if constexpr (!NOINSTRVIB) {
+        ptr_column(gt::STBL);
+        section();
+        for (int i = 1; i <= instr_count; ++i) instr[i].vibdelay = m_in.next();
+    }
+    if constexpr (!FIXEDPARAMS) {
+        section();
+        for (int i = 1; i <= instr_count; ++i) instr[i].gatetimer = m_in.next();
+        section();
+        for (int i = 1; i <= instr_count; ++i) instr[i].firstwave = m_in.next();
+    }
+    if (m_log.enabled(LOG_VERBOSE)) dump_instruments(instr_count);
+    return true;
+}
+
+
+// Only the wave table depends on a flag, so there is one instantiation per
+// table, and two for the wave table.
+template <uint32_t F>
+bool Sid2Song::decode_tables_as() {
+    if (!decode_table<gt::WTBL, bool(F & sid2sng::NOWAVEDELAY)>()) return false;
+    if constexpr (!(F & sid2sng::NOPULSE)) {
+        if (!decode_table<gt::PTBL, false>()) return false;
+    }
+    if constexpr (!(F & sid2sng::NOFILTER)) {
+        if (!decode_table<gt::FTBL, false>()) return false;
+    }
+    if (!decode_table<gt::STBL, false>()) return false;
+    return !m_truncated;
+}
+
+
+template <int T, bool NOWAVEDELAY>
+bool Sid2Song::decode_table() {
+
+    int*     max_table = m_max_table;
+    uint8_t* ltable    = m_song->ltable[T];
+    uint8_t* rtable    = m_song->rtable[T];
+    if (cancelled()) return false;
+    // TODO: maybe skip speed table
+    m_log.print(LOG_VERBOSE, "TABLE %d (min len %d)\n", T, max_table[T]);
+    if constexpr (T == gt::STBL) {
+        int x = read();
+        if (x != 0) return error(sid2sng::ERR_TABLE, "speed table");
+    }
+    section();
+    int x = 0;
+    if (!need(max_table[T])) return false;
+    for (int i = 0; i < max_table[T]; ++i) {
+        ltable[i] = x = m_in.next();
+    }
+    if constexpr (T < gt::STBL) {
+        while (x != 0xff) {
+            if (m_truncated || max_table[T] >= gt::MAX_TABLELEN) return error(sid2sng::ERR_TABLE, "table %d too long", T);
+            ltable[max_table[T]] = x = read();
+            ++max_table[T];
+        }
+    }
+    if constexpr (T == gt::STBL) {
+        // keep reading until we find a zero
+        while (peek() != 0) {
+            if (max_table[T] >= gt::MAX_TABLELEN) return error(sid2sng::ERR_TABLE, "table %d too long", T);
+            ltable[max_table[T]] = read();
+            ++max_table[T];
+        }
+        int x = read();
+        if (x != 0) return error(sid2sng::ERR_TABLE, "speed table");
+    }
+    section();
+    // speed table references found here can extend it, those are checked
+    int checked = max_table[T];
+    if (!need(checked)) return false;
+    for (int i = 0; i < max_table[T]; ++i) {
+        // read rtable
+        rtable[i] = i < checked ? m_in.next() : read();
+
+        // fix stuff
+        if constexpr (T == gt::WTBL) {
+            if constexpr (!NOWAVEDELAY) {
+                int x = ltable[i];
+                if (x > 0x1f && x < 0xf0) x -= 0x10;
+                else if (x > 0x0f && x < 0x20) x += 0xd0;
+                ltable[i] = x;
+            }
+
+            // flip bit
+            if (ltable[i] < gt::WAVECMD) rtable[i] ^= 0x80;
+        }
+        if constexpr (T == gt::FTBL) {
+            int x = ltable[i];
+            if (x > 0x80 && x < 0xff) {
+                ltable[i] = (x << 1) | 0x80;
+            }
+        }
+        if constexpr (T == gt::STBL) {
+            uint8_t x = ltable[i];
+            if ((x >= 0xf1 && x <= 0xf4) || x == 0xfe) {
+                max_table[gt::STBL] = std::max<int>(max_table[gt::STBL], rtable[i]);
+            }
+        }
+    }
+    if (m_log.enabled(LOG_VERBOSE)) dump_table(T, max_table[T]);
+    return true;
+}
+
+
+int Sid2Song::table_errors() const {
+    // jumps must stay inside their table
+    int errors = 0;
+    for (int t = 0; t < gt::STBL; ++t) {
+        int len = m_max_table[t];
+        for (int i = 0; i < len; ++i) {
+            if (m_song->ltable[t][i] == 0xff && m_song->rtable[t][i] > len) ++errors;
+        }
+    }
+    return errors;
+}
+
+
+// Runs init and a number of play calls. The indexed loads of the player show
+// where it keeps the song data.
+std::unique_ptr<Cpu6502> Sid2Song::trace_player() {
+    enum {
+        FRAMES       = 300,
+        INIT_CYCLES  = 1000000,
+        FRAME_CYCLES = 20000,
+    };
+    auto     cpu  = std::make_unique<Cpu6502>();
+    int      pos  = std::min<int>(m_info.offset + 2, m_data.size());
+    ByteSpan code = m_data.subspan(pos, m_data.size() - pos);
+    cpu->load(m_info.load_addr, code.data(), code.size());
+
+    uint16_t init = m_info.init_addr ? m_info.init_addr : m_info.load_addr;
+    int      song = m_info.start_song > 0 ? m_info.start_song - 1 : 0;
+    if (!cpu->call(init, song, INIT_CYCLES)) {
+        warning(sid2sng::WARN_EMULATION, "player init at %04X didn't return", init);
+        return nullptr;
+    }
+    if (m_info.play_addr == 0) {
+        warning(sid2sng::WARN_EMULATION, "no play address");
+        return nullptr;
+    }
+    for (int f = 0; f < FRAMES; ++f) {
+        if (!cpu->call(m_info.play_addr, 0, FRAME_CYCLES)) {
+            warning(sid2sng::WARN_EMULATION, "player didn't return in frame %d", f);
+            return nullptr;
+        }
+    }
+
+    // song and pattern tables don't depend on the features
+    int songs = m_song_count * m_song->channels;
+    int song_table = m_patt_table_pos - songs * 2 - m_addr_offset;
+    int patt_table = m_patt_table_pos - m_addr_offset;
+    m_log.print(LOG_VERBOSE, "emulate: %d frames, %llu cycles\n", (int) FRAMES, (unsigned long long) cpu->cycles());
+    m_log.print(LOG_VERBOSE, "emulate: song table %04X %s\n", song_table & 0xffff,
+                cpu->indexed(song_table) ? "traced" : "not traced");
+    m_log.print(LOG_VERBOSE, "emulate: pattern table %04X %s\n", patt_table & 0xffff,
+                cpu->indexed(patt_table) ? "traced" : "not traced");
+    return cpu;
+}
+
+int Sid2Song::traced_sections(Cpu6502 const& cpu) const {
+    // instruments and table rows count from 1, so players often index from
+    // one byte before the start
+    int hits = 0;
+    for (int i = 0; i < m_section_count; ++i) {
+        int addr = m_sections[i] - m_addr_offset;
+        if (addr < 1 || addr > 0xffff) continue;
+        if (cpu.indexed(addr) || cpu.indexed(addr - 1)) ++hits;
+    }
+    return hits;
+}
+
+
+// Instruments and tables are the only part whose layout depends on the
+// features. If they don't decode cleanly with the detected features, decode
+// them with every combination, closest to the detected one first, and keep
+// the best result. Clean means the tables end right where the first order
+// list starts. Once a candidate decodes cleanly, the ones ranked after it
+// can't win any more and are cancelled. The two combinations of each
+// instrument layout share the instruments and only decode their tables
+// apart.
+//
+// With emulation, all combinations are decoded, and among the cleanest ones
+// the one whose column and table starts match most of the player's indexed
+// loads wins.
+bool Sid2Song::search_features() {
+    struct Candidate {
+        uint32_t                  features;
+        int                       rank;
+        bool                      done     = false;
+        bool                      ok       = false;
+        int                       errors   = 0;
+        int                       distance = 0;
+        int                       hits     = 0;
+        std::unique_ptr<gt::Song> song;
+        std::unique_ptr<Sid2Song> conv;
+
+        // the detected features win if they decode cleanly; otherwise the
+        // emulator trace picks among the clean ones, then the distance to
+        // the detected features and the bad jumps
+        bool perfect() const { return ok && distance == 0; }
+        bool better(Candidate const& c) const {
+            if (ok != c.ok) return ok;
+            if (perfect() != c.perfect()) return perfect();
+            if (hits != c.hits) return hits > c.hits;
+            if (distance != c.distance) return distance < c.distance;
+            if (errors != c.errors) return errors < c.errors;
+            return rank < c.rank;
+        }
+    };
+
+    uint32_t detected = features();
+    auto bits = [](uint32_t x) { int n = 0; for (; x; x &= x - 1) ++n; return n; };
+    std::vector<Candidate> cands(sid2sng::FEATURE_COMBOS);
+    for (uint32_t f = 0; f < sid2sng::FEATURE_COMBOS; ++f) cands[f].features = f;
+    std::stable_sort(cands.begin(), cands.end(), [&](Candidate const& a, Candidate const& b) {
+        return bits(a.features ^ detected) < bits(b.features ^ detected);
+    });
+
+    std::unique_ptr<Cpu6502> cpu;
+    if (m_emulate) cpu = trace_player();
+
+    std::atomic<int> best_rank(sid2sng::FEATURE_COMBOS);
+    auto cancelled = [&best_rank](Candidate const* c) {
+        return !c || c->rank > best_rank.load(std::memory_order_relaxed);
+    };
+    // The instrument layout doesn't depend on the wave delay, so a and b,
+    // which only differ in it, share one instrument decode. b ranks after a
+    // and may be null.
+    auto decode = [this, &best_rank, &cpu, &cancelled](Candidate* a, Candidate* b) {
+        if (cancelled(a)) return;
+
+        // start from the song as it is before decoding instruments
+        a->song = std::make_unique<gt::Song>(*m_song);
+        a->conv = std::make_unique<Sid2Song>(*this);
+        Sid2Song& first    = *a->conv;
+        first.m_song       = a->song.get();
+        first.m_log        = Log(m_log.level());
+        first.m_error      = sid2sng::ERR_NONE;
+        first.m_truncated  = false;
+        first.m_cancel_rank = &best_rank;
+        first.m_rank       = a->rank;
+        first.set_features(a->features);
+        bool instruments = first.decode_instruments();
+        if (first.cancelled()) return;
+        if (!cancelled(b)) {
+            b->song = std::make_unique<gt::Song>(*a->song);
+            b->conv = std::make_unique<Sid2Song>(first);
+            b->conv->m_song = b->song.get();
+            b->conv->set_features(b->features);
+        }
+
+        for (Candidate* c : { a, b }) {
+            if (!c || !c->conv) continue;
+            Sid2Song& conv = *c->conv;
+            conv.m_rank = c->rank;
+            c->ok = instruments && conv.decode_tables();
+            if (conv.cancelled()) continue;
+            c->done     = true;
+            c->errors   = conv.table_errors();
+            c->distance = std::abs(conv.m_in.pos() - m_song_order_list_pos[0]);
+            if (cpu) {
+                // without a clear winner, every candidate has to be scored
+                c->hits = conv.traced_sections(*cpu);
+            }
+            else if (c->perfect()) {
+                int r = best_rank.load();
+                while (c->rank < r && !best_rank.compare_exchange_weak(r, c->rank)) {}
+            }
+        }
+    };
+
+    for (int r = 0; r < (int) cands.size(); ++r) cands[r].rank = r;
+
+    // the detected features usually work, only search if they don't
+    decode(&cands[0], nullptr);
+    if (cpu || !cands[0].perfect()) {
+        // the rest in pairs of the same layout, by the rank of the first
+        std::vector<std::pair<Candidate*, Candidate*>> pairs;
+        int layout_pair[sid2sng::FEATURE_COMBOS];
+        std::fill(layout_pair, layout_pair + sid2sng::FEATURE_COMBOS, -1);
+        for (size_t r = 1; r < cands.size(); ++r) {
+            int& i = layout_pair[cands[r].features & ~sid2sng::NOWAVEDELAY];
+            if (i < 0) {
+                i = pairs.size();
+                pairs.emplace_back(&cands[r], nullptr);
+            }
+            else {
+                pairs[i].second = &cands[r];
+            }
+        }
+        if (m_search_threads <= 1) {
+            // e.g. in batch mode, where the files already run in parallel
+            for (auto& pair : pairs) decode(pair.first, pair.second);
+        }
+        else {
+            std::vector<ThreadPool::Task> tasks;
+            for (auto& pair : pairs) {
+                tasks.push_back([&decode, pair](int) { decode(pair.first, pair.second); });
+            }
+            std::unique_ptr<ThreadPool> pool;
+            if (!m_search_pool) pool = std::make_unique<ThreadPool>(m_search_threads);
+            (m_search_pool ? m_search_pool : pool.get())->run(std::move(tasks));
+        }
+    }
+
+    Candidate* best = &cands[0];
+    int tried = 0;
+    for (Candidate& c : cands) {
+        // ones ranked after a clean decode may have finished alongside it
+        if (!c.done || c.rank > best_rank) continue;
+        ++tried;
+        if (c.better(*best)) best = &c;
+    }
+
+    // take over the winner
+    Sid2Song& conv = *best->conv;
+    for (int i = 0; i < gt::MAX_INSTR; ++i) m_song->instr[i] = best->song->instr[i];
+    memcpy(m_song->ltable, best->song->ltable, sizeof(m_song->ltable));
+    memcpy(m_song->rtable, best->song->rtable, sizeof(m_song->rtable));
+    memcpy(m_max_table, conv.m_max_table, sizeof(m_max_table));
+    m_in        = conv.m_in;
+    m_truncated = m_truncated || conv.m_truncated;
+    set_features(best->features);
+
+    if (cpu) {
+        m_log.print(LOG_SUMMARY, "emulate: %d of %d sections traced\n", best->hits, conv.m_section_count);
+    }
+    if (best->rank > 0) {
+        m_log.print(LOG_SUMMARY, "search: %d of %d combinations decoded\n", tried, (int) cands.size());
+        m_log.print(LOG_SUMMARY, "search nopulse = %d\n", m_nopulse);
+        m_log.print(LOG_SUMMARY, "search nofilter = %d\n", m_nofilter);
+        m_log.print(LOG_SUMMARY, "search noinstrvib = %d\n", m_noinstrvib);
+        m_log.print(LOG_SUMMARY, "search fixedparams = %d\n", m_fixedparams);
+        m_log.print(LOG_SUMMARY, "search nowavedelay = %d\n", m_nowavedelay);
+    }
+    m_log.print(LOG_ERROR, "%s", conv.m_log.buffer().c_str());
+    if (!best->ok) {
+        if (m_error == sid2sng::ERR_NONE) m_error = conv.m_error;
+        return false;
+    }
+    // the candidates start clean, so a cut off last pattern only shows here
+    return !m_truncated;
+}
@@ -0,0 +1,175 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "convertcache.hpp"
+#include "cursor.hpp"
+#include "detectcache.hpp"
+#include "gsong.hpp"
+#include "log.hpp"
+#include "mapfile.hpp"
+#include "sid2sng.hpp"
+#include "sidfile.hpp"
+
+class Cpu6502;
+class ThreadPool;
+
+
+// Converts a GoatTracker2 sid image back into a song. This is the converter
+// behind the sid2sng:: functions; it decodes into a song owned by the caller.
+class Sid2Song {
+public:
+
+    Sid2Song(gt::Song& song, sid2sng::Options const& options);
+    // without a song, only for probe()
+    explicit Sid2Song(sid2sng::Options const& options);
+
+    // a sng_filename of "-" writes to stdout, sng is scratch space
+    bool run(char const* sid_filename, char const* sng_filename, std::vector<uint8_t>& sng);
+    bool convert(ByteSpan data);
+    // runs the stages up to auto-detection, the song is not touched
+    bool probe(ByteSpan data, sid2sng::Probe& probe);
+    // Converts to GTS5 bytes, going through the convert cache if there is
+    // one. On a hit, the song is not decoded.
+    bool convert(ByteSpan data, std::vector<uint8_t>& sng);
+    // moves the log into the result
+    sid2sng::Result result();
+    // same, swapping buffers with res so a reused result keeps its capacity
+    void result(sid2sng::Result& res);
+
+    gt::Song& song() { return *m_song; }
+    uint32_t  features() const;
+    void      set_features(uint32_t features);
+
+    // The stages of convert(), in this order. They are public so the
+    // benchmark can time them separately.
+    bool load_sid(ByteSpan data);
+    bool find_freq_table();
+    void autodetect_options();
+    bool decode_order_lists();
+    bool decode_patterns();
+    bool decode_instruments();
+    bool decode_tables();
+
+    bool        m_nopulse      = false;
+    bool        m_nofilter     = false;
+    bool        m_noinstrvib   = false;
+    bool        m_fixedparams  = false;
+    bool        m_nowavedelay  = false;
+    bool        m_autodetect   = true;
+    bool        m_search       = false;
+    bool        m_emulate      = false;
+    bool        m_optimize     = false;
+    bool        m_timing       = false;
+    int         m_search_threads = 1;
+    // runs the search if there is more than one search thread, else a pool
+    // is made for it
+    ThreadPool* m_search_pool  = nullptr;
+    DetectCache* m_detect_cache = nullptr;
+    ConvertCache* m_convert_cache = nullptr;
+    uint64_t    m_cache_salt   = 0;    // the options that affect the output
+    // patterns that may differ from a cleared song; unless it's MAX_PATT,
+    // the song holds an earlier conversion and Song::reset() does instead of
+    // Song::clear(). Updated as the song is written.
+    int         m_dirty_patterns = gt::MAX_PATT;
+    Log         m_log;
+
+private:
+
+    bool read_header(ByteSpan data);
+    bool error(sid2sng::Error code, char const* fmt, ...);
+    void warning(sid2sng::Warning code, char const* fmt, ...);
+    void message(char const* prefix, char const* fmt, va_list args);
+
+    // adds the time since the last lap to the stage
+    void lap(sid2sng::Stage stage) {
+        if (!m_timing) return;
+        auto now = std::chrono::steady_clock::now();
+        m_stats.ns[stage] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_lap).count();
+        m_lap = now;
+    }
+
+    // one instantiation per feature combination
+    template <size_t... F> bool decode_instruments(std::index_sequence<F...>);
+    template <size_t... F> bool decode_tables(std::index_sequence<F...>);
+    template <uint32_t F> bool decode_instruments_as();
+    template <uint32_t F> bool decode_tables_as();
+    template <int T, bool NOWAVEDELAY> bool decode_table();
+
+    bool search_features();
+    int  table_errors() const;
+    std::unique_ptr<Cpu6502> trace_player();
+    int  traced_sections(Cpu6502 const& cpu) const;
+    // set while searching, when a better ranked candidate already succeeded
+    bool cancelled() const {
+        return m_cancel_rank && m_cancel_rank->load(std::memory_order_relaxed) < m_rank;
+    }
+
+    void dump_order_lists(int song);
+    void dump_pattern(int patt);
+    void dump_instruments(int count);
+    void dump_table(int t, int len);
+
+    // remembers where an instrument column or table starts
+    void section() {
+        if (m_section_count < MAX_SECTIONS) m_sections[m_section_count++] = m_in.pos();
+    }
+
+    // Checked reads for short or irregular data. Out-of-range reads return 0
+    // and flag the data as truncated.
+    uint8_t truncated() {
+        if (!m_truncated) error(sid2sng::ERR_TRUNCATED, "read past end of data (%d)", m_in.pos());
+        m_truncated = true;
+        return 0;
+    }
+    uint8_t peek() {
+        if (!m_in.has(1)) return truncated();
+        return m_in.peek();
+    }
+    uint8_t read() {
+        if (!m_in.has(1)) return truncated();
+        return m_in.next();
+    }
+    // checks a whole section, which is then read with m_in.next()
+    bool need(int n) {
+        if (m_in.has(n)) return true;
+        truncated();
+        return false;
+    }
+
+    gt::Song*            m_song = nullptr;
+    ByteSpan             m_data;
+    ByteSpan             m_player;
+    uint64_t             m_player_hash = 0;     // set by auto-detection
+    // where the log says the detect cache was hit, which depends on earlier
+    // conversions and so is left out of the convert cache
+    size_t               m_detect_hit_pos = 0;
+    size_t               m_detect_hit_len = 0;
+    SidInfo              m_info;
+    Cursor               m_in;
+    int                  m_song_count;
+    int                  m_addr_offset;
+    bool                 m_truncated = false;
+    sid2sng::Error       m_error     = sid2sng::ERR_NONE;
+    uint32_t             m_warnings  = 0;
+    sid2sng::Stats       m_stats;
+    std::chrono::steady_clock::time_point m_lap;
+
+    // carried from one stage to the next
+    int                  m_song_order_list_pos[gt::MAX_SONGS];
+    int                  m_patt_table_pos;
+    int                  m_patt_count;
+    int                  m_instr_count;
+    int                  m_max_table[gt::MAX_TABLES];
+
+    // feature search
+    enum { MAX_SECTIONS = 9 + 2 * gt::MAX_TABLES };
+    std::atomic<int> const* m_cancel_rank = nullptr;
+    int                  m_rank        = 0;
+    int                  m_sections[MAX_SECTIONS];
+    int                  m_section_count = 0;
+};
@@ -0,0 +1,43 @@
+#include "sidfile.hpp"
+#include <cstring>
+
+
+namespace {
+
+uint16_t be16(uint8_t const* p) { return p[0] << 8 | p[1]; }
+uint32_t be32(uint8_t const* p) { return uint32_t(be16(p)) << 16 | be16(p + 2); }
+
+} // namespace
+
+
+bool parse_sid_header(ByteSpan data, SidInfo& info) {
+    uint8_t const* p = data.data();
+    if (data.size() < SID_HEADER_V1_SIZE) return false;
+
+    info = {};
+    memcpy(info.magic, p, 4);
+    info.version    = be16(p + 0x04);
+    info.offset     = be16(p + 0x06);
+    info.load_addr  = be16(p + 0x08);
+    info.init_addr  = be16(p + 0x0a);
+    info.play_addr  = be16(p + 0x0c);
+    info.song_count = be16(p + 0x0e);
+    info.start_song = be16(p + 0x10);
+    info.speed      = be32(p + 0x12);
+    memcpy(info.song_name, p + 0x16, 32);
+    memcpy(info.song_author, p + 0x36, 32);
+    memcpy(info.song_released, p + 0x56, 32);
+    if (info.version > 1) {
+        if (data.size() < SID_HEADER_V2_SIZE) return false;
+        info.flags       = be16(p + 0x76);
+        info.start_page  = p[0x78];
+        info.page_length = p[0x79];
+        info.sid_addr_2  = p[0x7a];
+        info.sid_addr_3  = p[0x7b];
+    }
+
+    // GT2 always stores the load address in front of the data
+    if (info.offset + 2u > data.size()) return false;
+    info.load_addr = p[info.offset] | (p[info.offset + 1] << 8);
+    return true;
+}
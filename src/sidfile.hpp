@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include "mapfile.hpp"
+
+
+// PSID/RSID header, decoded from the big-endian file representation.
+struct SidInfo {
+    char     magic[4];
+    uint16_t version;
+    uint16_t offset;
+    uint16_t load_addr;
+    uint16_t init_addr;
+    uint16_t play_addr;
+    uint16_t song_count;
+    uint16_t start_song;
+    uint32_t speed;
+    char     song_name[32];
+    char     song_author[32];
+    char     song_released[32];
+    uint16_t flags;
+    uint8_t  start_page;
+    uint8_t  page_length;
+    uint8_t  sid_addr_2;
+    uint8_t  sid_addr_3;
+
+    int channels() const {
+        bool is_2sid = ((version >= 3) && (sid_addr_2 != 0x00));
+        bool is_3sid = ((version >= 4) && (sid_addr_2 != 0x00) && (sid_addr_3 != 0x00));
+        return is_3sid ? 9 : (is_2sid ? 6 : 3);
+    }
+};
+
+
+enum {
+    SID_HEADER_V1_SIZE = 0x76,
+    SID_HEADER_V2_SIZE = 0x7c,
+};
+
+
+// Returns false if data is too small to hold the header and load address.
+bool parse_sid_header(ByteSpan data, SidInfo& info);
@@ -0,0 +1,106 @@
+#include "sidindex.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "bytes.hpp"
+
+
+static char const INDEX_MAGIC[4]   = { 'S', '2', 'S', 'I' };
+static uint32_t const INDEX_FORMAT = 1;
+
+enum {
+    HEADER_SIZE = 16,
+    // hash, player hash, size, mtime, path offset, path length, anchor,
+    // error, channels, songs, features
+    RECORD_SIZE = 48,
+    PATH_FIELD  = 32,
+};
+
+
+uint64_t SidIndex::hash(ByteSpan sid) {
+    return fnv1a(sid.data(), sid.size());
+}
+
+
+bool SidIndex::write(char const* filename, std::vector<Record> records) {
+    std::sort(records.begin(), records.end(), [](Record const& a, Record const& b) {
+        return a.path < b.path;
+    });
+    size_t paths = 0;
+    for (Record const& r : records) paths += r.path.size();
+    if (records.size() > UINT32_MAX / RECORD_SIZE || paths > UINT32_MAX) return false;
+
+    std::vector<uint8_t> data(HEADER_SIZE + records.size() * RECORD_SIZE);
+    memcpy(data.data(), INDEX_MAGIC, 4);
+    put32(data.data() + 4, INDEX_FORMAT);
+    put32(data.data() + 8, records.size());
+    put32(data.data() + 12, paths);
+    uint32_t offset = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        Record const& r = records[i];
+        uint8_t* p = data.data() + HEADER_SIZE + i * RECORD_SIZE;
+        put64(p, r.hash);
+        put64(p + 8, r.probe.player_hash);
+        put64(p + 16, r.size);
+        put64(p + 24, r.mtime);
+        put32(p + PATH_FIELD, offset);
+        put32(p + PATH_FIELD + 4, r.path.size());
+        put32(p + 40, r.probe.anchor);
+        p[44] = r.probe.error;
+        p[45] = r.probe.channels;
+        p[46] = std::min(r.probe.songs, 255);
+        p[47] = r.probe.features;
+        offset += r.path.size();
+    }
+    for (Record const& r : records) data.insert(data.end(), r.path.begin(), r.path.end());
+
+    // readers may have the old index mapped, so don't write into it
+    std::string tmp = std::string(filename) + ".tmp";
+    FILE* file = fopen(tmp.c_str(), "wb");
+    if (!file) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+    // rename doesn't replace existing files on windows
+    if (ok) remove(filename);
+#endif
+    ok = ok && rename(tmp.c_str(), filename) == 0;
+    if (!ok) remove(tmp.c_str());
+    return ok;
+}
+
+
+bool SidIndex::open(char const* filename, std::string* error) {
+    auto fail = [error](char const* msg) {
+        if (error) *error = msg;
+        return false;
+    };
+    m_table = PathTable();
+    if (!m_file.open(filename)) return fail("could not open file");
+    ByteSpan data = m_file.span();
+    if (data.size() < HEADER_SIZE || memcmp(data.data(), INDEX_MAGIC, 4) != 0) return fail("not a sid index");
+    if (get32(data.data() + 4) != INDEX_FORMAT) return fail("unknown index format");
+    uint64_t count = get32(data.data() + 8);
+    uint64_t paths = get32(data.data() + 12);
+    if (HEADER_SIZE + count * RECORD_SIZE + paths != data.size()) return fail("index size mismatch");
+    m_table = PathTable(data.data() + HEADER_SIZE, count, RECORD_SIZE, PATH_FIELD, paths);
+    return true;
+}
+
+
+SidIndex::Record SidIndex::record(int i) const {
+    uint8_t const* p    = m_table.rec(i);
+    ByteSpan       path = m_table.path(i);
+    Record r;
+    r.path  = std::string((char const*) path.data(), path.size());
+    r.hash  = get64(p);
+    r.size  = get64(p + 16);
+    r.mtime = get64(p + 24);
+    r.probe.player_hash = get64(p + 8);
+    r.probe.anchor      = get32(p + 40);
+    r.probe.error       = sid2sng::Error(p[44]);
+    r.probe.channels    = p[45];
+    r.probe.songs       = p[46];
+    r.probe.features    = p[47];
+    return r;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mapfile.hpp"
+#include "pathtable.hpp"
+#include "sid2sng.hpp"
+
+// Binary index of a sid collection, written by a scan that probes every
+// file, and read memory mapped. Records have a fixed size and are sorted by
+// path, so a lookup is a binary search straight on the mapping, without
+// parsing the file first.
+//
+// Layout, all numbers little-endian:
+//   header   magic "S2SI", format, record count, size of the path bytes
+//   records  RECORD_SIZE bytes each, see Record
+//   paths    relative to the scanned directory, '/' separated, no terminator
+class SidIndex {
+public:
+    struct Record {
+        std::string    path;
+        uint64_t       hash  = 0;   // of the whole file
+        uint64_t       size  = 0;
+        int64_t        mtime = 0;   // opaque, only compared for equality
+        sid2sng::Probe probe;       // the song count is clamped to 255
+    };
+
+    static uint64_t hash(ByteSpan sid);
+    static bool     write(char const* filename, std::vector<Record> records);
+
+    bool   open(char const* filename, std::string* error = nullptr);
+    int    size() const { return m_table.size(); }
+    Record record(int i) const;
+    // index of the record, or -1
+    int    find(std::string const& path) const { return m_table.find(path); }
+
+private:
+    MappedFile m_file;
+    PathTable  m_table;
+};
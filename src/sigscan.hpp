@@ -0,0 +1,236 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "memsearch.hpp"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Byte signature scanner used for auto-detecting player features.
+//
+// Signatures are written in the same notation the old regex based detection
+// used: \xHH matches a byte, a dot (.) matches any byte, (a|b) is an
+// alternation and a trailing ? makes the preceding group optional. Groups
+// don't nest. Each signature is expanded into a small set of fixed-length
+// alternatives at compile time, so matching is a masked compare.
+
+namespace sig {
+
+enum {
+    MAX_ALTS    = 8,
+    MAX_LEN     = 24,
+    MAX_SCANALT = 32,
+};
+
+struct Alt {
+    int     len;
+    uint8_t value[MAX_LEN];
+    uint8_t mask[MAX_LEN];
+};
+
+struct Signature {
+    bool valid;
+    int  alt_count;
+    Alt  alts[MAX_ALTS];
+};
+
+
+namespace detail {
+
+constexpr int hex(char c) {
+    return c >= '0' && c <= '9' ? c - '0'
+         : c >= 'a' && c <= 'f' ? c - 'a' + 10
+         : c >= 'A' && c <= 'F' ? c - 'A' + 10
+         : -1;
+}
+
+// parse a single byte or wildcard and append it to alt
+constexpr bool parse_atom(char const*& p, Alt& alt) {
+    if (alt.len >= MAX_LEN) return false;
+    if (*p == '.') {
+        alt.value[alt.len] = 0;
+        alt.mask[alt.len]  = 0;
+        ++alt.len;
+        ++p;
+        return true;
+    }
+    if (p[0] == '\\' && p[1] == 'x' && hex(p[2]) >= 0 && hex(p[3]) >= 0) {
+        alt.value[alt.len] = hex(p[2]) * 16 + hex(p[3]);
+        alt.mask[alt.len]  = 0xff;
+        ++alt.len;
+        p += 4;
+        return true;
+    }
+    return false;
+}
+
+constexpr bool append(Alt& dst, Alt const& src) {
+    if (dst.len + src.len > MAX_LEN) return false;
+    for (int i = 0; i < src.len; ++i) {
+        dst.value[dst.len] = src.value[i];
+        dst.mask[dst.len]  = src.mask[i];
+        ++dst.len;
+    }
+    return true;
+}
+
+} // namespace detail
+
+
+constexpr Signature compile(char const* p) {
+    Signature s = {};
+    s.alt_count = 1;
+    while (*p) {
+        if (*p != '(') {
+            for (int a = 0; a < s.alt_count; ++a) {
+                char const* q = p;
+                if (!detail::parse_atom(q, s.alts[a])) return s;
+                if (a == s.alt_count - 1) p = q;
+            }
+            continue;
+        }
+
+        // group
+        Alt branches[MAX_ALTS] = {};
+        int branch_count = 1;
+        for (++p; *p != ')'; ) {
+            if (!*p) return s;
+            if (*p == '|') {
+                if (branch_count == MAX_ALTS) return s;
+                ++branch_count;
+                ++p;
+                continue;
+            }
+            if (!detail::parse_atom(p, branches[branch_count - 1])) return s;
+        }
+        ++p;
+        if (*p == '?') {
+            if (branch_count == MAX_ALTS) return s;
+            branches[branch_count++] = {};
+            ++p;
+        }
+
+        // cross product with what we have so far
+        if (s.alt_count * branch_count > MAX_ALTS) return s;
+        Signature r = {};
+        for (int a = 0; a < s.alt_count; ++a) {
+            for (int b = 0; b < branch_count; ++b) {
+                Alt& alt = r.alts[r.alt_count++];
+                alt = s.alts[a];
+                if (!detail::append(alt, branches[b])) return s;
+            }
+        }
+        s = r;
+    }
+    for (int a = 0; a < s.alt_count; ++a) {
+        if (s.alts[a].len == 0) return s;
+    }
+    s.valid = true;
+    return s;
+}
+
+
+// Matches up to 32 signatures in a single pass. Candidate positions are found
+// with find_pairs() on the first and last literal byte of each alternative,
+// the alternatives to verify are then looked up by the first byte.
+template <int N>
+class Scanner {
+public:
+    static_assert(N <= 32, "too many signatures");
+
+    constexpr Scanner(Signature const (&sigs)[N]) {
+        for (int s = 0; s < N; ++s) {
+            m_valid = m_valid && sigs[s].valid;
+            for (int a = 0; a < sigs[s].alt_count; ++a) {
+                if (m_alt_count == MAX_SCANALT) {
+                    m_valid = false;
+                    return;
+                }
+                Alt const& alt = sigs[s].alts[a];
+                int i = m_alt_count++;
+                m_alts[i]      = alt;
+                m_sig[i]       = s;
+                m_sig_alts[s] |= 1u << i;
+
+                // use the first and last literal byte as filter
+                int last = alt.len - 1;
+                while (last > 0 && alt.mask[last] != 0xff) --last;
+                m_pairs[i]  = { alt.value[0], alt.value[last], uint16_t(last) };
+                m_prefilter = m_prefilter && alt.mask[0] == 0xff;
+                for (int b = 0; b < 256; ++b) {
+                    if ((b & alt.mask[0]) == alt.value[0]) m_first[b] |= 1u << i;
+                }
+            }
+        }
+    }
+
+    constexpr bool valid() const { return m_valid; }
+
+    // returns a bit mask of the signatures found in data
+    uint32_t scan(uint8_t const* data, size_t size) const {
+        uint32_t const all  = N == 32 ? ~0u : (1u << N) - 1;
+        uint32_t       live = m_alt_count == 32 ? ~0u : (1u << m_alt_count) - 1;
+        uint32_t       found = 0;
+
+        BytePair pairs[MAX_SCANALT];
+        int      pair_count = live_pairs(live, pairs);
+
+        for (size_t pos = 0; pos < size; ++pos) {
+            if (m_prefilter) {
+                pos = find_pairs(data, size, pos, pairs, pair_count);
+                if (pos == size) break;
+            }
+            uint32_t cand = m_first[data[pos]] & live;
+            while (cand) {
+                int a = ctz(cand);
+                cand &= cand - 1;
+                if (!match(m_alts[a], data + pos, size - pos)) continue;
+                found |= 1u << m_sig[a];
+                if (found == all) return found;
+                live &= ~m_sig_alts[m_sig[a]];
+                cand &= live;
+                pair_count = live_pairs(live, pairs);
+            }
+        }
+        return found;
+    }
+
+private:
+
+    int live_pairs(uint32_t live, BytePair* pairs) const {
+        int n = 0;
+        for (int i = 0; i < m_alt_count; ++i) {
+            if (live & (1u << i)) pairs[n++] = m_pairs[i];
+        }
+        return n;
+    }
+
+    static bool match(Alt const& alt, uint8_t const* p, size_t size) {
+        if ((size_t) alt.len > size) return false;
+        for (int i = 1; i < alt.len; ++i) {
+            if ((p[i] & alt.mask[i]) != alt.value[i]) return false;
+        }
+        return true;
+    }
+
+    static int ctz(uint32_t x) {
+#ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward(&i, x);
+        return i;
+#else
+        return __builtin_ctz(x);
+#endif
+    }
+
+    bool     m_valid              = true;
+    bool     m_prefilter          = true;
+    int      m_alt_count          = 0;
+    Alt      m_alts[MAX_SCANALT]  = {};
+    int      m_sig[MAX_SCANALT]   = {};
+    uint32_t m_sig_alts[N]        = {};
+    uint32_t m_first[256]         = {};
+    BytePair m_pairs[MAX_SCANALT] = {};
+};
+
+} // namespace sig
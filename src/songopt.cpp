@@ -0,0 +1,190 @@
+#include "songopt.hpp"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include "bytes.hpp"
+
+
+namespace {
+
+enum {
+    MAX_REPEAT = 16,    // REPEAT + 15 plays the next pattern 16 times
+};
+
+uint64_t hash_pattern(uint8_t const* rows, int len) {
+    return fnv1a(rows, len * 4, FNV_BASIS ^ len);
+}
+
+// Length of an order list, up to the LOOPSONG byte.
+int order_len(uint8_t const* order) {
+    int len = 0;
+    while (len < gt::MAX_SONGLEN && order[len] < gt::LOOPSONG) ++len;
+    return len;
+}
+
+// Merges consecutive plays of the same pattern. Entries are parsed into
+// transposes and plays of a pattern; the restart position has to start an
+// entry, and that entry is never merged into the one before. Returns the
+// number of bytes saved.
+int fold_repeats(uint8_t* order) {
+    struct Entry {
+        int     start;
+        uint8_t cmd;    // transpose, or pattern
+        int     plays;  // 0 for transposes
+    };
+    int len     = order_len(order);
+    int restart = order[len + 1];
+    std::vector<Entry> entries;
+    bool restart_ok = false;
+    for (int i = 0; i < len;) {
+        if (i == restart) restart_ok = true;
+        uint8_t x = order[i];
+        if (x >= gt::TRANSDOWN) {
+            entries.push_back({ i, x, 0 });
+            i += 1;
+        }
+        else if (x >= gt::REPEAT) {
+            if (i + 1 >= len || order[i + 1] >= gt::REPEAT) return 0;
+            entries.push_back({ i, order[i + 1], x - gt::REPEAT + 1 });
+            i += 2;
+        }
+        else {
+            entries.push_back({ i, x, 1 });
+            i += 1;
+        }
+    }
+    if (!restart_ok) return 0;
+
+    std::vector<Entry> merged;
+    for (Entry const& e : entries) {
+        Entry* prev = merged.empty() ? nullptr : &merged.back();
+        if (prev && e.plays && prev->plays && e.cmd == prev->cmd && e.start != restart) {
+            prev->plays += e.plays;
+        }
+        else {
+            merged.push_back(e);
+        }
+    }
+
+    int p = 0;
+    int new_restart = 0;
+    for (Entry const& e : merged) {
+        if (e.start == restart) new_restart = p;
+        if (!e.plays) {
+            order[p++] = e.cmd;
+            continue;
+        }
+        for (int n = e.plays; n > 0; n -= MAX_REPEAT) {
+            int chunk = std::min<int>(n, MAX_REPEAT);
+            if (chunk > 1) order[p++] = gt::REPEAT + chunk - 1;
+            order[p++] = e.cmd;
+        }
+    }
+    // never longer, splitting only happens past 16 plays, which took at
+    // least as many bytes before
+    order[p]     = gt::LOOPSONG;
+    order[p + 1] = new_restart;
+    // leave the freed bytes as a decoded list would, see Song::reset()
+    memset(order + p + 2, 0, len - p);
+    return len - p;
+}
+
+} // namespace
+
+
+gt::OptimizeStats gt::optimize(Song& song) {
+    OptimizeStats stats;
+    song.count_pattern_lengths();
+    int highest_instr   = song.highestusedinstr;
+    int highest_pattern = song.highestusedpattern;
+
+    // patterns the order lists play
+    bool played[MAX_PATT] = {};
+    for (int s = 0; s < MAX_SONGS; ++s) {
+        for (int c = 0; c < song.channels; ++c) {
+            uint8_t const* order = song.songorder[s][c];
+            for (int i = 0, len = order_len(order); i < len; ++i) {
+                if (order[i] < REPEAT) played[order[i]] = true;
+            }
+        }
+    }
+
+    // the first of identical patterns stands in for the others
+    int canonical[MAX_PATT];
+    std::unordered_map<uint64_t, std::vector<int>> seen;
+    for (int p = 0; p < MAX_PATT; ++p) {
+        canonical[p] = p;
+        if (!played[p]) continue;
+        int len = song.pattlen[p];
+        std::vector<int>& same = seen[hash_pattern(song.pattern[p], len)];
+        for (int q : same) {
+            if (song.pattlen[q] == len && memcmp(song.pattern[q], song.pattern[p], len * 4) == 0) {
+                canonical[p] = q;
+                ++stats.merged_patterns;
+                break;
+            }
+        }
+        if (canonical[p] == p) same.push_back(p);
+    }
+
+    // renumber the remaining patterns in order, moving them down
+    uint8_t remap[MAX_PATT];
+    int     count = 0;
+    for (int p = 0; p < MAX_PATT; ++p) {
+        if (!played[p]) {
+            if (p <= highest_pattern) ++stats.dropped_patterns;
+            continue;
+        }
+        if (canonical[p] != p) continue;
+        if (count != p) memcpy(song.pattern[count], song.pattern[p], sizeof(song.pattern[p]));
+        remap[p] = count++;
+    }
+    for (int p = 0; p < MAX_PATT; ++p) {
+        if (played[p]) remap[p] = remap[canonical[p]];
+    }
+    // nothing past the highest used pattern is played or moved, and those
+    // slots hold only rests already
+    for (int p = count; p <= highest_pattern; ++p) song.clear_pattern(p);
+
+    for (int s = 0; s < MAX_SONGS; ++s) {
+        for (int c = 0; c < song.channels; ++c) {
+            uint8_t* order = song.songorder[s][c];
+            for (int i = 0, len = order_len(order); i < len; ++i) {
+                if (order[i] < REPEAT) order[i] = remap[order[i]];
+            }
+            stats.folded_orders += fold_repeats(order);
+        }
+    }
+
+    // instruments set by the remaining patterns
+    bool used[MAX_INSTR] = {};
+    song.count_pattern_lengths();
+    for (int p = 0; p < count; ++p) {
+        for (int r = 0; r < song.pattlen[p]; ++r) used[song.pattern[p][r * 4 + 1]] = true;
+    }
+    uint8_t instr_remap[MAX_INSTR] = {};
+    int     instr_count = 1;
+    for (int i = 1; i < MAX_INSTR; ++i) {
+        if (!used[i]) continue;
+        if (instr_count != i) song.instr[instr_count] = song.instr[i];
+        instr_remap[i] = instr_count++;
+    }
+    for (int i = instr_count; i < MAX_INSTR; ++i) song.clear_instr(i);
+    stats.dropped_instruments = std::max(0, highest_instr - (instr_count - 1));
+    for (int p = 0; p < count; ++p) {
+        for (int r = 0; r < song.pattlen[p]; ++r) {
+            uint8_t& instr = song.pattern[p][r * 4 + 1];
+            instr = instr_remap[instr];
+        }
+    }
+
+    // Slots up to highestusedpattern are saved even if unplayed, e.g. for
+    // the default order lists of unused channels. Keep them at one row.
+    song.count_pattern_lengths();
+    for (int p = count; p <= song.highestusedpattern; ++p) {
+        song.pattern[p][4] = ENDPATT;
+        song.pattlen[p]    = 1;
+    }
+    return stats;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "gsong.hpp"
+
+namespace gt {
+
+struct OptimizeStats {
+    int merged_patterns     = 0;    // duplicates of another pattern
+    int dropped_patterns    = 0;    // not in any order list
+    int folded_orders       = 0;    // order list bytes saved by repeats
+    int dropped_instruments = 0;    // not in any pattern
+};
+
+// Shrinks the song without changing playback: merges identical patterns,
+// drops patterns that no order list plays, folds runs of the same pattern
+// into REPEAT entries and drops instruments that no pattern sets. Patterns
+// and instruments are renumbered in their original order.
+OptimizeStats optimize(Song& song);
+
+} // namespace gt
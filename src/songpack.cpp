@@ -0,0 +1,203 @@
+#include "songpack.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include "bytes.hpp"
+
+
+static char const PACK_MAGIC[4]   = { 'S', '2', 'S', 'P' };
+static uint32_t const PACK_FORMAT = 1;
+static char const INDEX_NAME[]    = "sid2sng.index";
+
+enum {
+    TAR_BLOCK   = 512,
+    TAR_END     = 2 * TAR_BLOCK,    // zero blocks after the last member
+    TAR_NAME    = 100,
+    FOOTER_SIZE = 16,
+    // hash, song offset, song size, path offset, path length, warnings,
+    // features, error and 3 zero bytes
+    RECORD_SIZE = 40,
+    PATH_FIELD  = 20,
+};
+
+
+static uint64_t round_up(uint64_t x) {
+    return (x + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+}
+
+
+// octal digits and a terminating zero
+static void put_octal(uint8_t* p, int n, uint64_t x) {
+    p[n - 1] = 0;
+    for (int i = n - 2; i >= 0; --i, x >>= 3) p[i] = '0' + (x & 7);
+}
+
+static void tar_header(uint8_t* h, std::string const& name, uint64_t size, char type, uint64_t mtime) {
+    memset(h, 0, TAR_BLOCK);
+    memcpy(h, name.data(), std::min<size_t>(name.size(), TAR_NAME));
+    put_octal(h + 100, 8, 0644);
+    put_octal(h + 108, 8, 0);
+    put_octal(h + 116, 8, 0);
+    put_octal(h + 124, 12, size);
+    put_octal(h + 136, 12, mtime);
+    h[156] = type;
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    // the checksum counts its own field as spaces
+    memset(h + 148, ' ', 8);
+    uint32_t sum = 0;
+    for (int i = 0; i < TAR_BLOCK; ++i) sum += h[i];
+    put_octal(h + 148, 7, sum);
+}
+
+
+PackWriter::~PackWriter() {
+    if (m_file) {
+        fclose(m_file);
+        remove(m_tmp.c_str());
+    }
+}
+
+bool PackWriter::open(char const* filename) {
+    m_filename = filename;
+    m_tmp      = m_filename + ".tmp";
+    m_file     = fopen(m_tmp.c_str(), "wb");
+    if (!m_file) return false;
+    // songs are small, collect a lot of them per write
+    setvbuf(m_file, nullptr, _IOFBF, 1 << 20);
+    m_mtime = time(nullptr);
+    return true;
+}
+
+
+bool PackWriter::write_member(std::string const& name, ByteSpan data, uint64_t& offset) {
+    static uint8_t const zeros[TAR_BLOCK] = {};
+    auto write = [this](void const* p, size_t n) {
+        if (n && fwrite(p, 1, n, m_file) != n) m_ok = false;
+        m_offset += n;
+    };
+    uint8_t h[TAR_BLOCK];
+    if (name.size() > TAR_NAME) {
+        // GNU long name, which precedes the member as a member of its own
+        tar_header(h, "././@LongLink", name.size() + 1, 'L', m_mtime);
+        write(h, TAR_BLOCK);
+        write(name.c_str(), name.size() + 1);
+        write(zeros, round_up(name.size() + 1) - name.size() - 1);
+    }
+    tar_header(h, name, data.size(), '0', m_mtime);
+    write(h, TAR_BLOCK);
+    offset = m_offset;
+    write(data.data(), data.size());
+    write(zeros, round_up(data.size()) - data.size());
+    return m_ok;
+}
+
+
+void PackWriter::add(std::string const& sid_path, std::string const& sng_name, uint64_t sid_hash,
+                     sid2sng::Result const& res, ByteSpan sng) {
+    Record r;
+    r.path     = sid_path;
+    r.hash     = sid_hash;
+    r.offset   = 0;
+    r.size     = sng.size();
+    r.warnings = res.warnings;
+    r.features = res.features;
+    r.error    = res.error;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file) return;
+    if (!sng.empty()) write_member(sng_name, sng, r.offset);
+    m_records.push_back(std::move(r));
+}
+
+
+bool PackWriter::finish() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file) return false;
+    std::sort(m_records.begin(), m_records.end(), [](Record const& a, Record const& b) {
+        return a.path < b.path;
+    });
+    size_t paths = 0;
+    for (Record const& r : m_records) paths += r.path.size();
+    if (m_records.size() > UINT32_MAX / RECORD_SIZE || paths > UINT32_MAX) m_ok = false;
+
+    // the footer ends the padded index, right before the end blocks
+    size_t used = m_records.size() * RECORD_SIZE + paths + FOOTER_SIZE;
+    std::vector<uint8_t> index(round_up(used));
+    uint32_t offset = 0;
+    for (size_t i = 0; i < m_records.size(); ++i) {
+        Record const& r = m_records[i];
+        uint8_t* p = index.data() + i * RECORD_SIZE;
+        put64(p, r.hash);
+        put64(p + 8, r.offset);
+        put32(p + 16, r.size);
+        put32(p + PATH_FIELD, offset);
+        put32(p + PATH_FIELD + 4, r.path.size());
+        put32(p + 28, r.warnings);
+        put32(p + 32, r.features);
+        p[36] = r.error;
+        offset += r.path.size();
+    }
+    uint8_t* p = index.data() + m_records.size() * RECORD_SIZE;
+    for (Record const& r : m_records) {
+        memcpy(p, r.path.data(), r.path.size());
+        p += r.path.size();
+    }
+    uint8_t* footer = index.data() + index.size() - FOOTER_SIZE;
+    memcpy(footer, PACK_MAGIC, 4);
+    put32(footer + 4, PACK_FORMAT);
+    put32(footer + 8, m_records.size());
+    put32(footer + 12, paths);
+
+    uint64_t index_offset;
+    write_member(INDEX_NAME, ByteSpan(index.data(), index.size()), index_offset);
+    static uint8_t const end[TAR_END] = {};
+    if (fwrite(end, 1, TAR_END, m_file) != TAR_END) m_ok = false;
+    m_ok = fclose(m_file) == 0 && m_ok;
+    m_file = nullptr;
+#ifdef _WIN32
+    // rename doesn't replace existing files on windows
+    if (m_ok) remove(m_filename.c_str());
+#endif
+    m_ok = m_ok && rename(m_tmp.c_str(), m_filename.c_str()) == 0;
+    if (!m_ok) remove(m_tmp.c_str());
+    return m_ok;
+}
+
+
+bool SongPack::open(char const* filename, std::string* error) {
+    auto fail = [error](char const* msg) {
+        if (error) *error = msg;
+        return false;
+    };
+    m_table = PathTable();
+    if (!m_file.open(filename)) return fail("could not open file");
+    ByteSpan data = m_file.span();
+    if (data.size() < TAR_BLOCK + TAR_BLOCK + TAR_END) return fail("not a song pack");
+    uint8_t const* footer = data.end() - TAR_END - FOOTER_SIZE;
+    if (memcmp(footer, PACK_MAGIC, 4) != 0) return fail("not a song pack");
+    if (get32(footer + 4) != PACK_FORMAT) return fail("unknown pack format");
+    uint64_t count = get32(footer + 8);
+    uint64_t paths = get32(footer + 12);
+    uint64_t index = round_up(count * RECORD_SIZE + paths + FOOTER_SIZE);
+    if (index > data.size() - TAR_END - TAR_BLOCK) return fail("pack index size mismatch");
+    m_table = PathTable(data.end() - TAR_END - index, count, RECORD_SIZE, PATH_FIELD, paths);
+    return true;
+}
+
+
+SongPack::Entry SongPack::entry(int i) const {
+    uint8_t const* p    = m_table.rec(i);
+    ByteSpan       path = m_table.path(i);
+    Entry e;
+    e.path     = std::string((char const*) path.data(), path.size());
+    e.hash     = get64(p);
+    e.warnings = get32(p + 28);
+    e.features = get32(p + 32);
+    e.error    = sid2sng::Error(p[36]);
+    // songs lie before the index
+    uint64_t offset = get64(p + 8);
+    uint32_t size   = get32(p + 16);
+    uint64_t end    = m_table.records() - m_file.span().data();
+    if (offset <= end && size <= end - offset) e.song = { m_file.span().data() + offset, size };
+    return e;
+}
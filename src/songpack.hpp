@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "mapfile.hpp"
+#include "pathtable.hpp"
+#include "sid2sng.hpp"
+
+// Batch output in a single file: a tar of the GTS5 images with an index as
+// its last member, so it unpacks with any tar and can also be read memory
+// mapped. The index member is padded to whole tar blocks and ends with a
+// footer, which is thus found at a fixed distance from the end of the file.
+//
+// Index layout, all numbers little-endian:
+//   records  RECORD_SIZE bytes each, sorted by path, see SongPack::Entry
+//   paths    source sid paths, '/' separated, no terminator
+//   padding  zeros, up to the footer
+//   footer   magic "S2SP", format, record count, size of the path bytes
+
+// Appends songs to a pack. Songs are written in the order they are added
+// through one buffered stream, which is renamed into place by finish().
+// add() may be called from several threads.
+class PackWriter {
+public:
+    PackWriter() = default;
+    PackWriter(PackWriter const&) = delete;
+    PackWriter& operator=(PackWriter const&) = delete;
+    ~PackWriter();
+
+    bool open(char const* filename);
+    // sng is empty for failed conversions, which are only indexed
+    void add(std::string const& sid_path, std::string const& sng_name, uint64_t sid_hash,
+             sid2sng::Result const& res, ByteSpan sng);
+    // writes the index; false if anything could not be written
+    bool finish();
+
+private:
+    struct Record {
+        std::string path;
+        uint64_t    hash;
+        uint64_t    offset;
+        uint32_t    size;
+        uint32_t    warnings;
+        uint32_t    features;
+        uint8_t     error;
+    };
+
+    bool write_member(std::string const& name, ByteSpan data, uint64_t& offset);
+
+    std::mutex          m_mutex;
+    std::string         m_filename;
+    std::string         m_tmp;
+    FILE*               m_file   = nullptr;
+    uint64_t            m_offset = 0;
+    uint64_t            m_mtime  = 0;
+    bool                m_ok     = true;
+    std::vector<Record> m_records;
+};
+
+// A pack, memory mapped. Lookups are binary searches on the index.
+class SongPack {
+public:
+    struct Entry {
+        std::string    path;            // of the sid, relative to the batch input
+        uint64_t       hash     = 0;    // SidIndex::hash of the sid
+        uint32_t       warnings = 0;
+        uint32_t       features = 0;    // disabled features used for decoding
+        sid2sng::Error error    = sid2sng::ERR_NONE;
+        ByteSpan       song;            // GTS5 image, empty on error
+    };
+
+    bool  open(char const* filename, std::string* error = nullptr);
+    int   size() const { return m_table.size(); }
+    Entry entry(int i) const;
+    // index of the entry, or -1
+    int   find(std::string const& path) const { return m_table.find(path); }
+
+private:
+    MappedFile m_file;
+    PathTable  m_table;
+};
@@ -0,0 +1,88 @@
+#include "threadpool.hpp"
+
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads < 1) threads = 1;
+    for (int i = 0; i < threads; ++i) m_queues.emplace_back(new Queue);
+    for (int i = 1; i < threads; ++i) m_threads.emplace_back(&ThreadPool::wait_for_work, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_start.notify_all();
+    for (std::thread& t : m_threads) t.join();
+}
+
+
+bool ThreadPool::pop(int worker, Task& task) {
+    Queue& q = *m_queues[worker];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) return false;
+    task = std::move(q.tasks.front());
+    q.tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::steal(int worker, Task& task) {
+    int n = threads();
+    for (int i = 1; i < n; ++i) {
+        Queue& q = *m_queues[(worker + i) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) continue;
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return true;
+    }
+    return false;
+}
+
+
+// no tasks are added while running, so a worker is done
+// as soon as all queues are empty
+void ThreadPool::work(int worker) {
+    Task task;
+    while (pop(worker, task) || steal(worker, task)) {
+        task(worker);
+    }
+}
+
+void ThreadPool::wait_for_work(int worker) {
+    uint64_t done = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start.wait(lock, [&] { return m_stop || m_run != done; });
+            if (m_stop) return;
+            done = m_run;
+        }
+        work(worker);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busy == 0) m_done.notify_one();
+    }
+}
+
+
+void ThreadPool::run(std::vector<Task> tasks) {
+    int n = threads();
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        Queue& q = *m_queues[i % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(std::move(tasks[i]));
+    }
+    if (n == 1) {
+        work(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_run;
+        m_busy = n - 1;
+    }
+    m_start.notify_all();
+    work(0);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_busy == 0; });
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool for a known set of tasks. Each worker owns a
+// deque and takes tasks from its front. A worker that runs dry steals from
+// the back of the other workers' deques. Tasks get the index of the worker
+// that runs them, so callers can keep per-worker state. The worker threads
+// are started once and wait between runs, so a pool is cheap to reuse.
+class ThreadPool {
+public:
+    using Task = std::function<void(int worker)>;
+
+    explicit ThreadPool(int threads);
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+    ~ThreadPool();
+
+    int threads() const { return (int) m_queues.size(); }
+
+    // Tasks are dealt round-robin in the given order, so sorting them by
+    // decreasing cost gives a good initial balance. The calling thread is
+    // worker 0. Blocks until all tasks have finished; only one run at a time.
+    void run(std::vector<Task> tasks);
+
+private:
+
+    struct Queue {
+        std::mutex       mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool pop(int worker, Task& task);
+    bool steal(int worker, Task& task);
+    void work(int worker);
+    void wait_for_work(int worker);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread>            m_threads;
+
+    // hands runs to the waiting workers
+    std::mutex              m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    uint64_t                m_run  = 0;     // number of runs started
+    int                     m_busy = 0;     // workers still in the current run
+    bool                    m_stop = false;
+};
@@ -0,0 +1,335 @@
+#include "watch.hpp"
+#include <cstdio>
+
+#ifdef __linux__
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "sidindex.hpp"
+#include "threadpool.hpp"
+
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum {
+    QUIET_MS     = 250,     // a burst of events ends after this long without any
+    MAX_DELAY_MS = 5000,    // but files wait at most this long
+    EVENTS       = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE,
+};
+
+volatile std::sig_atomic_t g_stop = 0;
+
+void on_signal(int) {
+    g_stop = 1;
+}
+
+bool is_sid(fs::path const& path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".sid";
+}
+
+// Reads a whole file. Writers may still change a file in the drop folder,
+// and a mapped file that shrinks would kill the watcher with SIGBUS.
+bool read_file(char const* filename, std::vector<uint8_t>& data) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    data.clear();
+    size_t  size = 0;
+    ssize_t n;
+    do {
+        if (data.size() - size < 64 * 1024) data.resize(size + 64 * 1024);
+        n = read(fd, data.data() + size, data.size() - size);
+        if (n > 0) size += n;
+    } while (n > 0 || (n < 0 && errno == EINTR));
+    close(fd);
+    data.resize(size);
+    return n == 0;
+}
+
+
+class Watcher {
+public:
+    Watcher(sid2sng::Options const& options, char const* indir, char const* outdir, int threads)
+        : m_indir(indir), m_outdir(outdir), m_pool(threads)
+        , m_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+    {
+        for (int i = 0; i < m_pool.threads(); ++i) m_converters.emplace_back(options);
+        m_buffers.resize(m_pool.threads());
+    }
+    ~Watcher() { if (m_fd >= 0) close(m_fd); }
+
+    int run();
+
+private:
+    struct File {
+        uint64_t size;
+        int64_t  mtime;
+        uint64_t hash;
+    };
+
+    bool add_tree(fs::path const& dir);
+    void remove_tree(fs::path const& dir);
+    void read_events();
+    void convert_pending(bool initial);
+
+    fs::path                m_indir;
+    fs::path                m_outdir;
+    ThreadPool              m_pool;
+    std::vector<sid2sng::Converter> m_converters;   // one per worker
+    std::vector<std::vector<uint8_t>> m_buffers;    // the sid read by each worker
+    int                     m_fd;
+    bool                    m_rescan = false;
+    std::unordered_map<int, fs::path>     m_dirs;     // by watch descriptor
+    std::unordered_map<std::string, File> m_files;    // as last converted or checked
+    std::set<std::string>                 m_pending;
+};
+
+
+// Watches dir and all directories below it, and queues the sids in there,
+// which may have been written before the watch was in place.
+bool Watcher::add_tree(fs::path const& dir) {
+    std::error_code ec;
+    auto watch = [this](fs::path const& d) {
+        int wd = inotify_add_watch(m_fd, d.c_str(), EVENTS);
+        if (wd < 0) {
+            fprintf(stderr, "WARNING: can't watch %s: %s\n", d.c_str(), strerror(errno));
+            return;
+        }
+        m_dirs[wd] = d;
+    };
+    watch(dir);
+    for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_directory(ec)) watch(it->path());
+        else if (it->is_regular_file(ec) && is_sid(it->path())) m_pending.insert(it->path().string());
+    }
+    if (ec) fprintf(stderr, "ERROR: %s: %s\n", dir.c_str(), ec.message().c_str());
+    return !ec;
+}
+
+// A directory moved away keeps its watches, which would report wrong paths.
+void Watcher::remove_tree(fs::path const& dir) {
+    std::string prefix = (dir / "").string();
+    for (auto it = m_dirs.begin(); it != m_dirs.end();) {
+        std::string path = it->second.string();
+        if (it->second == dir || path.compare(0, prefix.size(), prefix) == 0) {
+            inotify_rm_watch(m_fd, it->first);
+            it = m_dirs.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+
+void Watcher::read_events() {
+    alignas(inotify_event) char buf[16 * 1024];
+    for (;;) {
+        ssize_t n = read(m_fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        for (char* p = buf; p < buf + n;) {
+            inotify_event const* e = (inotify_event const*) p;
+            p += sizeof(inotify_event) + e->len;
+            if (e->mask & IN_Q_OVERFLOW) {
+                // events were lost, compare the whole tree
+                m_rescan = true;
+                continue;
+            }
+            if (e->mask & IN_IGNORED) {
+                m_dirs.erase(e->wd);
+                continue;
+            }
+            auto dir = m_dirs.find(e->wd);
+            if (dir == m_dirs.end() || e->len == 0) continue;
+            fs::path path = dir->second / e->name;
+            if (e->mask & IN_ISDIR) {
+                if (e->mask & (IN_CREATE | IN_MOVED_TO)) add_tree(path);
+                if (e->mask & IN_MOVED_FROM) remove_tree(path);
+                continue;
+            }
+            if (!is_sid(path)) continue;
+            if (e->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                m_files.erase(path.string());
+            }
+            else if (e->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                // files that are only created get a close event once written
+                m_pending.insert(path.string());
+            }
+        }
+    }
+}
+
+
+// Checks the pending files and converts the changed ones in parallel. On
+// the initial pass, files with a song newer than the sid are up to date.
+void Watcher::convert_pending(bool initial) {
+    enum Outcome { GONE, UNCHANGED, CONVERTED, FAILED };
+    struct Item {
+        std::string sid;
+        std::string sng;
+        bool        known;
+        File        old;
+        File        now;
+        Outcome     outcome = GONE;
+    };
+    std::vector<Item> items;
+    for (std::string const& sid : m_pending) {
+        Item item;
+        item.sid = sid;
+        fs::path sng = m_outdir / fs::path(sid).lexically_relative(m_indir);
+        sng.replace_extension(".sng");
+        item.sng = sng.string();
+        auto it = m_files.find(sid);
+        item.known = it != m_files.end();
+        if (item.known) item.old = it->second;
+        items.push_back(std::move(item));
+    }
+    m_pending.clear();
+
+    std::vector<ThreadPool::Task> tasks;
+    for (Item& item : items) {
+        tasks.push_back([this, &item, initial](int worker) {
+            // a file that can't be read at any step is gone
+            std::error_code ec;
+            fs::path sid = item.sid;
+            item.now.size = fs::file_size(sid, ec);
+            if (ec) return;
+            item.now.mtime = fs::last_write_time(sid, ec).time_since_epoch().count();
+            if (ec) return;
+            if (item.known && item.now.size == item.old.size && item.now.mtime == item.old.mtime) {
+                item.now.hash = item.old.hash;
+                item.outcome  = UNCHANGED;
+                return;
+            }
+            std::vector<uint8_t>& data = m_buffers[worker];
+            if (!read_file(item.sid.c_str(), data)) return;
+            ByteSpan span(data.data(), data.size());
+            item.now.hash = SidIndex::hash(span);
+            if (item.known && item.now.hash == item.old.hash) {
+                item.outcome = UNCHANGED;
+                return;
+            }
+            if (initial) {
+                auto sng_time = fs::last_write_time(item.sng, ec);
+                if (!ec && sng_time >= fs::last_write_time(sid, ec) && !ec) {
+                    item.outcome = UNCHANGED;
+                    return;
+                }
+                ec.clear();
+            }
+
+            fs::create_directories(fs::path(item.sng).parent_path(), ec);
+            sid2sng::Converter& conv = m_converters[worker];
+            sid2sng::Result     res  = conv.convert(span);
+            if (res.ok()) {
+                ByteSpan song = conv.sng();
+                FILE* file = fopen(item.sng.c_str(), "wb");
+                bool  ok   = file && fwrite(song.data(), 1, song.size(), file) == song.size();
+                if (file) ok = fclose(file) == 0 && ok;
+                if (!ok) {
+                    res.error = sid2sng::ERR_WRITE;
+                    res.log  += "ERROR: could not write " + item.sng + "\n";
+                }
+            }
+            item.outcome = res.ok() ? CONVERTED : FAILED;
+            // one write per file keeps the output of workers apart
+            if (!res.log.empty()) {
+                std::string report = item.sid + "\n" + res.log;
+                fwrite(report.data(), 1, report.size(), stdout);
+            }
+        });
+    }
+    m_pool.run(std::move(tasks));
+
+    int count[FAILED + 1] = {};
+    for (Item const& item : items) {
+        ++count[item.outcome];
+        if (item.outcome == GONE) m_files.erase(item.sid);
+        else m_files[item.sid] = item.now;
+    }
+    if (count[CONVERTED] || count[FAILED] || !initial) {
+        printf("%d files checked, %d converted, %d failed, %d unchanged\n",
+               (int) items.size() - count[GONE], count[CONVERTED], count[FAILED], count[UNCHANGED]);
+    }
+    fflush(stdout);
+}
+
+
+int Watcher::run() {
+    if (m_fd < 0) {
+        fprintf(stderr, "ERROR: inotify: %s\n", strerror(errno));
+        return 1;
+    }
+    if (!add_tree(m_indir)) return 1;
+    convert_pending(true);
+    printf("watching %d directories below %s\n", (int) m_dirs.size(), m_indir.c_str());
+    fflush(stdout);
+
+    Clock::time_point first, last;
+    while (!g_stop) {
+        int timeout = -1;
+        if (!m_pending.empty() || m_rescan) {
+            auto due = std::min(last + std::chrono::milliseconds(QUIET_MS),
+                                first + std::chrono::milliseconds(MAX_DELAY_MS));
+            auto ms  = std::chrono::duration_cast<std::chrono::milliseconds>(due - Clock::now()).count();
+            timeout  = std::max<int>(0, ms);
+            if (timeout == 0) {
+                if (m_rescan) add_tree(m_indir);
+                m_rescan = false;
+                convert_pending(false);
+                continue;
+            }
+        }
+        pollfd pfd = { m_fd, POLLIN, 0 };
+        int    r   = poll(&pfd, 1, timeout);
+        if (r < 0 && errno != EINTR) {
+            fprintf(stderr, "ERROR: poll: %s\n", strerror(errno));
+            return 1;
+        }
+        if (r <= 0) continue;
+        bool idle = m_pending.empty() && !m_rescan;
+        read_events();
+        last = Clock::now();
+        if (idle) first = last;
+    }
+    return 0;
+}
+
+} // namespace
+
+
+int run_watch(sid2sng::Options const& options, char const* indir, char const* outdir, int threads) {
+    // stop between bursts, without restarting poll
+    struct sigaction sa = {};
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    Watcher watcher(options, indir, outdir, threads);
+    return watcher.run();
+}
+
+#else
+
+int run_watch(sid2sng::Options const&, char const*, char const*, int) {
+    fprintf(stderr, "ERROR: -watch needs inotify, which is only available on Linux\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#pragma once
+#include "sid2sng.hpp"
+
+// -watch mode of the command line tool. Converts the sids below indir that
+// have no up to date song in outdir, then waits for new, changed and moved
+// in files with inotify. Events are coalesced until the tree has been quiet
+// for a moment, and files whose size, modification time and content hash
+// are unchanged are skipped. Each burst is converted on threads workers.
+// Runs until SIGINT or SIGTERM; only supported on Linux.
+int run_watch(sid2sng::Options const& options, char const* indir, char const* outdir, int threads);